@@ -0,0 +1,154 @@
+#define _GNU_SOURCE             /* for DT_* and syscall() on glibc */
+
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/syscall.h>        /* for SYS_getdents64 */
+#endif
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>           /* for NAME_MAX */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dir.h"
+#include "logging.h"
+
+#ifndef DT_UNKNOWN
+#define DT_UNKNOWN 0
+#endif
+
+#if defined(__linux__) && defined(SYS_getdents64)
+#define USE_GETDENTS
+#endif
+
+#ifdef USE_GETDENTS
+/* the kernel's record format, glibc doesn't export it under this name */
+struct linux_dirent64 {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+#endif
+
+struct dirreader {
+#ifdef USE_GETDENTS
+    int fd;                     /* not owned */
+    char *buf;
+    size_t bufsize;
+    size_t pos;                 /* offset of the next record in buf */
+    size_t end;                 /* number of valid bytes in buf */
+#else
+    DIR *dir;
+#endif
+    DirEntry entry;
+};
+
+DirReader *newdirreader(int fd, size_t bufsize)
+{
+    if (fd < 0) {
+        errorf("fd is invalid\n");
+        errno = EBADF;
+        return NULL;
+    }
+
+    DirReader *reader = malloc(sizeof(*reader));
+    if (!reader) {
+        errorf("Out of memory\n");
+        errno = ENOMEM;
+        return NULL;
+    }
+
+#ifdef USE_GETDENTS
+    /* must hold at least one maximum size record */
+    if (bufsize < sizeof(struct linux_dirent64) + NAME_MAX + 1) {
+        bufsize = DIRBUFSIZE;
+    }
+    reader->fd = fd;
+    reader->buf = malloc(bufsize);
+    if (!reader->buf) {
+        errorf("Out of memory\n");
+        free(reader);
+        errno = ENOMEM;
+        return NULL;
+    }
+    reader->bufsize = bufsize;
+    reader->pos = 0;
+    reader->end = 0;
+#else
+    (void)bufsize;
+    /* fdopendir() takes ownership of its fd, so give it a copy */
+    int dupfd = dup(fd);
+    if (dupfd == -1) {
+        free(reader);
+        return NULL;
+    }
+    reader->dir = fdopendir(dupfd);
+    if (!reader->dir) {
+        close(dupfd);
+        free(reader);
+        return NULL;
+    }
+#endif
+
+    return reader;
+}
+
+void freedirreader(DirReader *reader)
+{
+    if (!reader) return;
+#ifdef USE_GETDENTS
+    free(reader->buf);
+#else
+    closedir(reader->dir);
+#endif
+    free(reader);
+}
+
+const DirEntry *readdirentry(DirReader *reader)
+{
+    if (!reader) {
+        errorf("reader is NULL\n");
+        errno = EINVAL;
+        return NULL;
+    }
+
+#ifdef USE_GETDENTS
+    if (reader->pos >= reader->end) {
+        long nbytes = syscall(SYS_getdents64, reader->fd, reader->buf, reader->bufsize);
+        if (nbytes <= 0) {
+            if (nbytes == 0) errno = 0;
+            return NULL;
+        }
+        reader->pos = 0;
+        reader->end = nbytes;
+    }
+    /* walk the records in place, no copying */
+    struct linux_dirent64 *record = (struct linux_dirent64 *)(reader->buf + reader->pos);
+    reader->pos += record->d_reclen;
+    reader->entry.inode = record->d_ino;
+    reader->entry.type = record->d_type;
+    reader->entry.name = record->d_name;
+#else
+    errno = 0;
+    struct dirent *dirent = readdir(reader->dir);
+    if (!dirent) {
+        return NULL;
+    }
+    reader->entry.inode = dirent->d_ino;
+#ifdef DT_DIR
+    reader->entry.type = dirent->d_type;
+#else
+    reader->entry.type = DT_UNKNOWN;
+#endif
+    reader->entry.name = dirent->d_name;
+#endif
+
+    return &reader->entry;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
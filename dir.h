@@ -0,0 +1,55 @@
+#ifndef DIR_H
+#define DIR_H
+
+#include <sys/types.h>
+#include <stddef.h>
+
+/* default size of the buffer used to read directory entries in bulk */
+#define DIRBUFSIZE (256 * 1024)
+
+typedef struct dirreader DirReader;
+
+/**
+ * A single directory entry.
+ *
+ * type is a DT_* value from <dirent.h>, or DT_UNKNOWN (0) if the
+ * file system didn't tell us.
+ */
+typedef struct direntry {
+    ino_t inode;
+    unsigned char type;
+    const char *name;
+} DirEntry;
+
+/**
+ * Start reading the directory open as fd.
+ *
+ * On Linux, entries are read with getdents64() into a buffer of bufsize
+ * bytes, so huge directories need few system calls.
+ * Elsewhere, readdir() is used.
+ *
+ * The reader doesn't take ownership of fd.  The caller must keep it open
+ * until the reader is freed, and close it afterwards.
+ *
+ * Returns NULL and sets errno on failure.
+ */
+DirReader *newdirreader(int fd, size_t bufsize);
+
+/**
+ * Free any memory held by reader.
+ */
+void freedirreader(DirReader *reader);
+
+/**
+ * Return the next entry in the directory,
+ * or NULL at the end of the directory or on error.
+ *
+ * errno is 0 at the end of the directory.
+ *
+ * The entry and its name point into reader's buffer,
+ * so they are only valid until the next call.
+ */
+const DirEntry *readdirentry(DirReader *reader);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
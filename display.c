@@ -32,8 +32,9 @@ const int outermargin = 2;
  * TODO Make the width/fieldwidth/screenwidth/displaywidth terminology better.
  *
  * screenwidth is the width of the screen in columns.
+ * Output goes to out.
  */
-void printacross(StringList *list, int stringwidth, int screenwidth)
+void printacross(FILE *out, StringList *list, int stringwidth, int screenwidth)
 {
     if (list == NULL) {
         errorf("list is NULL\n");
@@ -50,18 +51,18 @@ void printacross(StringList *list, int stringwidth, int screenwidth)
     int col = 0;
     for (int i = 0; i < len; i++) {
         char *str = getitem(list, i);
-        printf("%s", str);
+        fputs(str, out);
         col++;
         if (col == cols) {
-            printf("\n");
+            fputc('\n', out);
             col = 0;
         }
         else {
-            printspaces(outermargin);
+            printspaces(out, outermargin);
         }
     }
     if (col != 0) {
-        printf("\n");
+        fputc('\n', out);
     }
 }
 
@@ -74,8 +75,9 @@ void printacross(StringList *list, int stringwidth, int screenwidth)
  * i.e. should all have the same field "width".
  *
  * screenwidth is the width of the screen in columns.
+ * Output goes to out.
  */
-void printdown(StringList *list, int stringwidth, int screenwidth)
+void printdown(FILE *out, StringList *list, int stringwidth, int screenwidth)
 {
     if (list == NULL) {
         errorf("list is NULL\n");
@@ -101,22 +103,22 @@ void printdown(StringList *list, int stringwidth, int screenwidth)
                 break;
             }
             char *elem = getitem(list, idx);
-            printf("%s", elem);
+            fputs(elem, out);
             if (col == cols-1) {
                 break;
             }
             else {
-                printspaces(outermargin);
+                printspaces(out, outermargin);
             }
         }
-        printf("\n");
+        fputc('\n', out);
     }
 }
 
-void printspaces(int n)
+void printspaces(FILE *out, int n)
 {
     for (int i = 0; i < n; i++) {
-        putchar(' ');
+        fputc(' ', out);
     }
 }
 
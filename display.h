@@ -1,6 +1,8 @@
 #ifndef DISPLAY_H
 #define DISPLAY_H
 
+#include <stdio.h>
+
 #include "list.h"
 
 /* terminal escape sequences for -G and -K flags
@@ -20,9 +22,9 @@ typedef struct colors {
 
 typedef List StringList;
 
-void printacross(StringList *list, int stringwidth, int screenwidth);
-void printdown(StringList *list, int stringwidth, int screenwidth);
-void printspaces(int n);
+void printacross(FILE *out, StringList *list, int stringwidth, int screenwidth);
+void printdown(FILE *out, StringList *list, int stringwidth, int screenwidth);
+void printspaces(FILE *out, int n);
 
 int ceildiv(int num, int mult);
 int setupcolors(Colors *colors);
@@ -1,4 +1,4 @@
-#define _XOPEN_SOURCE 600   /* for readlink(), strdup(), snprintf() */
+#define _XOPEN_SOURCE 700   /* for fstatat(), readlinkat(), strdup(), snprintf() */
 #define _GNU_SOURCE         /* for strverscmp() on glibc */
 
 #include <sys/stat.h>
@@ -13,8 +13,9 @@
 #include <sys/acl.h>
 #endif
 #include <ctype.h>
+#include <dirent.h>         /* for DT_* */
 #include <errno.h>
-#include <fcntl.h>          /* for AT_FDCWD, AT_SYMLINK_NOFOLLOW */
+#include <fcntl.h>          /* for openat(), AT_FDCWD, AT_SYMLINK_NOFOLLOW */
 #include <grp.h>
 #include <libgen.h>
 #include <pwd.h>
@@ -73,12 +74,36 @@ static int strverscmp(const char *l0, const char *r0)
 #include "logging.h"
 #include "map.h"
 
+/*
+ * A directory that files were found in.
+ *
+ * All the files in a directory share one of these, rather than each
+ * holding a copy of the directory's path, and it holds on to its own
+ * parent in the same way, so a tree of files only stores each name once.
+ */
+typedef struct dirnode {
+    unsigned int refs;              /* updated atomically, see holdnode() */
+    struct dirnode *parent;         /* NULL for a directory named on its own */
+    char name[];                    /* the name in parent, else the whole path */
+} DirNode;
+
 struct file {
-    char *name;
-    char *path;
+    DirNode *dir;                  /* the directory file's name is in, NULL if none */
+    DirNode *self;                 /* file as the directory of other files, see newfilein() */
+    char *path;                    /* built by getpath() when first needed, else NULL */
+    int dirfd;                     /* open fd of the parent directory, or AT_FDCWD, not owned */
+    char *atname;                  /* path relative to dirfd if different from name, else NULL */
+    mode_t type;                   /* S_IFMT bits if known, from readdir() or lstat() */
+    ino_t inode;                   /* inode number if known from readdir(), else 0 */
     int didstat;
+    int staterr;                   /* errno from a stat that hasn't been reported yet, else 0 */
     struct stat *pstat;
+    time_t btime;                  /* birth time from the same statx(), 0 if unknown */
     struct file *target;           /* holds target file if this file is a symlink */
+    int targeterr;                 /* error from reading the symlink, see readtarget() */
+    signed char acls;              /* result of hasacls(), -1 until known */
+    int aclerr;                    /* errno from looking up ACLs, else 0 */
+    char name[];
 };
 
 /**
@@ -88,9 +113,14 @@ struct file {
  * if the command line argument was /tmp/foo, that's what we print in
  * the output.  Use getname(file) for that.
  *
- * We also need a file's full path so that we can pass the correct argument
- * to lstat, etc when listing something other than the current directory.
- * Use getpath(file) for that.
+ * We also need a file's full path for error messages and directory headings.
+ * Use getpath(file) for that.  Files only hold their name, and a reference
+ * to their directory, so the path is only built if it's asked for.
+ *
+ * System calls don't use the full path, though.  Files found by listing
+ * a directory hold the fd of that directory, and fstatat(), readlinkat(),
+ * etc. look up just the name relative to it, so the kernel doesn't have
+ * to walk the whole path again for every call.
  *
  * There are also getdirname(file) and getbasename(file), which
  * work like POSIX basename() and dirname().
@@ -101,47 +131,143 @@ struct file {
  */
 File *newfile(const char *dir, const char *name)
 {
-    if (!dir) {
-        errorf("dir is NULL\n");
-        return NULL;
+    return newfileat(AT_FDCWD, dir, name);
+}
+
+static DirNode *holdnode(DirNode *node)
+{
+    if (node) {
+        /* files in the same directory may be freed on different threads */
+        __atomic_fetch_add(&node->refs, 1, __ATOMIC_RELAXED);
     }
-    if (!name) {
-        errorf("name is NULL\n");
-        return NULL;
+    return node;
+}
+
+static void releasenode(DirNode *node)
+{
+    while (node && __atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        DirNode *parent = node->parent;
+        free(node);
+        node = parent;
     }
+}
 
-    File *file = malloc(sizeof *file);
-    if (!file) {
-        errorf("Out of memory\n");
+/**
+ * Create a DirNode called name in parent, which it takes a reference to.
+ */
+static DirNode *newnode(DirNode *parent, const char *name)
+{
+    size_t size = strlen(name) + 1;
+    DirNode *node = malloc(sizeof(*node) + size);
+    if (!node) {
         return NULL;
     }
+    node->refs = 1;
+    node->parent = holdnode(parent);
+    memcpy(node->name, name, size);
+    return node;
+}
 
-    char *namecopy = strdup(name);
-    if (!namecopy) {
-        errorf("namecopy is NULL\n");
-        free(file);
+/**
+ * Create a File called name in the directory dir, taking a new reference to dir.
+ */
+static File *newfilenode(int dirfd, DirNode *dir, const char *name)
+{
+    if (!name) {
+        errorf("name is NULL\n");
         return NULL;
     }
-    file->name = namecopy;
 
-    char *path = makepath(dir, name);
-    if (!path) {
-        errorf("path is NULL\n");
-        free(namecopy);
-        free(file);
+    size_t size = strlen(name) + 1;
+    File *file = malloc(sizeof(*file) + size);
+    if (!file) {
+        errorf("Out of memory\n");
         return NULL;
     }
-    file->path = path;
+    memcpy(file->name, name, size);
+    file->dir = holdnode(dir);
+    file->self = NULL;
+    file->path = NULL;
+    file->dirfd = dirfd;
+    file->atname = NULL;
 
     /* to be filled in as and when required */
     /* calling code must check if these are NULL */
+    file->type = 0;
+    file->inode = 0;
     file->didstat = 0;
+    file->staterr = 0;
     file->pstat = NULL;
+    file->btime = 0;
     file->target = NULL;
+    file->targeterr = 0;
+    file->acls = -1;
+    file->aclerr = 0;
 
     return file;
 }
 
+File *newfileat(int dirfd, const char *dir, const char *name)
+{
+    if (!dir) {
+        errorf("dir is NULL\n");
+        return NULL;
+    }
+
+    /* like makepath(), an empty dir means name is the whole path */
+    DirNode *node = NULL;
+    if (*dir) {
+        node = newnode(NULL, dir);
+        if (!node) {
+            errorf("Out of memory\n");
+            return NULL;
+        }
+    }
+    File *file = newfilenode(dirfd, node, name);
+    releasenode(node);
+    return file;
+}
+
+File *newfilein(int dirfd, File *dir, const char *name)
+{
+    if (!dir) {
+        errorf("dir is NULL\n");
+        return NULL;
+    }
+    if (!dir->self) {
+        /* the first file in dir, the rest share this */
+        dir->self = newnode(dir->dir, dir->name);
+        if (!dir->self) {
+            errorf("Out of memory\n");
+            return NULL;
+        }
+    }
+    return newfilenode(dirfd, dir->self, name);
+}
+
+void setdirentinfo(File *file, ino_t inode, unsigned char type)
+{
+    if (!file) {
+        errorf("file is NULL\n");
+        return;
+    }
+
+    file->inode = inode;
+    switch (type) {
+    case DT_BLK:  file->type = S_IFBLK;  break;
+    case DT_CHR:  file->type = S_IFCHR;  break;
+    case DT_DIR:  file->type = S_IFDIR;  break;
+    case DT_FIFO: file->type = S_IFIFO;  break;
+    case DT_LNK:  file->type = S_IFLNK;  break;
+    case DT_REG:  file->type = S_IFREG;  break;
+    case DT_SOCK: file->type = S_IFSOCK; break;
+    default:
+        /* DT_UNKNOWN or something unusual, ask lstat() later */
+        file->type = 0;
+        break;
+    }
+}
+
 /**
  * Free all memory allocated by newfile.
  */
@@ -149,8 +275,10 @@ void freefile(File *file)
 {
     if (!file) return;
 
-    free(file->name);
+    releasenode(file->dir);
+    releasenode(file->self);
     free(file->path);
+    free(file->atname);
     free(file->pstat);
     freefile(file->target);
     free(file);
@@ -167,6 +295,40 @@ const char *getname(File *file)
     return file->name;
 }
 
+int getdepth(File *file)
+{
+    int depth = 0;
+    for (DirNode *dir = file ? file->dir : NULL; dir; dir = dir->parent) {
+        depth++;
+    }
+    return depth;
+}
+
+/**
+ * Return the length of the path to name in dir, as makepath() would make it.
+ */
+static size_t pathlength(DirNode *dir, const char *name)
+{
+    if (!dir || name[0] == '/') {
+        return strlen(name);
+    }
+    return pathlength(dir->parent, dir->name) + 1 + strlen(name);
+}
+
+/**
+ * Write the path to name in dir at p, and return the end of it.
+ */
+static char *writepath(DirNode *dir, const char *name, char *p)
+{
+    if (dir && name[0] != '/') {
+        p = writepath(dir->parent, dir->name, p);
+        *p++ = '/';
+    }
+    size_t length = strlen(name);
+    memcpy(p, name, length);
+    return p + length;
+}
+
 const char *getpath(File *file)
 {
     if (!file) {
@@ -174,8 +336,15 @@ const char *getpath(File *file)
         return NULL;
     }
 
-    //char *pathcopy = strdup(file->path);
-    //return pathcopy;
+    if (!file->path) {
+        char *path = malloc(pathlength(file->dir, file->name) + 1);
+        if (!path) {
+            errorf("Out of memory\n");
+            return NULL;
+        }
+        *writepath(file->dir, file->name, path) = '\0';
+        file->path = path;
+    }
     return file->path;
 }
 
@@ -191,7 +360,11 @@ char *getbasename(File *file)
     * I'm following the POSIX version according to the Linux man pages
     * thus I have to take a copy of the path
     */
-    char *pathcopy = strdup(file->path);
+    const char *path = getpath(file);
+    if (!path) {
+        return NULL;
+    }
+    char *pathcopy = strdup(path);
     char *base = basename(pathcopy);
     char *namecopy = strdup(base);
     free(pathcopy);
@@ -205,19 +378,243 @@ char *getdirname(File *file)
         return NULL;
     }
 
-    if (!file->path) {
-        errorf("file->path is NULL\n");
+    const char *path = getpath(file);
+    if (!path) {
         return NULL;
     }
-    char *pathcopy = strdup(file->path);
+    char *pathcopy = strdup(path);
     char *dir = dirname(pathcopy);
     char *dircopy = strdup(dir);
     free(pathcopy);
     return dircopy;
 }
 
+/**
+ * Return the path to pass to *at() system calls along with file->dirfd.
+ */
+static const char *getatpath(File *file)
+{
+    if (file->dirfd == AT_FDCWD) {
+        return getpath(file);
+    }
+    return file->atname ? file->atname : file->name;
+}
+
+int opendirectory(File *file)
+{
+    if (!file) {
+        errorf("file is NULL\n");
+        errno = EINVAL;
+        return -1;
+    }
+    return openat(file->dirfd, getatpath(file), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+/* updated atomically, since files may be fetched on several threads */
+static unsigned long nstats = 0;
+
+unsigned long getstatcount(void)
+{
+    return __atomic_load_n(&nstats, __ATOMIC_RELAXED);
+}
+
+#ifdef __linux__
+/* what to ask statx() for, see setstatfields() */
+static unsigned int statxmask = STATX_BASIC_STATS | STATX_BTIME;
+/* set if the kernel is too old for statx() */
+static bool nostatx = false;
+#endif
+
+void setstatfields(unsigned int fields)
+{
+#ifdef __linux__
+    /* always needed to answer isdir(), isexec(), etc. */
+    unsigned int mask = STATX_TYPE | STATX_MODE;
+    if (fields & STAT_NLINK)  mask |= STATX_NLINK;
+    if (fields & STAT_UID)    mask |= STATX_UID;
+    if (fields & STAT_GID)    mask |= STATX_GID;
+    if (fields & STAT_ATIME)  mask |= STATX_ATIME;
+    if (fields & STAT_MTIME)  mask |= STATX_MTIME;
+    if (fields & STAT_CTIME)  mask |= STATX_CTIME;
+    if (fields & STAT_INO)    mask |= STATX_INO;
+    if (fields & STAT_SIZE)   mask |= STATX_SIZE;
+    if (fields & STAT_BLOCKS) mask |= STATX_BLOCKS;
+    if (fields & STAT_BTIME)  mask |= STATX_BTIME;
+    statxmask = mask;
+#else
+    (void)fields;
+#endif
+}
+
+#ifdef __linux__
+/* the flags every statx() of a File uses */
+#define STATX_FLAGS (AT_SYMLINK_NOFOLLOW | AT_STATX_SYNC_AS_STAT)
+
+/**
+ * Convert the result of a statx() into pstat and file->btime.
+ */
+static void fromstatx(File *file, const struct statx *stx, struct stat *pstat)
+{
+    memset(pstat, 0, sizeof(*pstat));
+    pstat->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    pstat->st_ino = stx->stx_ino;
+    pstat->st_mode = stx->stx_mode;
+    pstat->st_nlink = stx->stx_nlink;
+    pstat->st_uid = stx->stx_uid;
+    pstat->st_gid = stx->stx_gid;
+    pstat->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+    pstat->st_size = stx->stx_size;
+    pstat->st_blksize = stx->stx_blksize;
+    pstat->st_blocks = stx->stx_blocks;
+    pstat->st_atim.tv_sec = stx->stx_atime.tv_sec;
+    pstat->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+    pstat->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+    pstat->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+    pstat->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+    pstat->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+    if (stx->stx_mask & STATX_BTIME) {
+        file->btime = stx->stx_btime.tv_sec;
+    }
+}
+#endif
+
+/**
+ * lstat() file into pstat, and fill in file->btime if possible.
+ *
+ * On Linux this is a single statx() call asking only for the fields
+ * set by setstatfields().
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int dostat(File *file, struct stat *pstat)
+{
+#ifdef __linux__
+    if (!nostatx) {
+        struct statx stx;
+        memset(&stx, 0, sizeof(stx));
+        if (syscall(SYS_statx, file->dirfd, getatpath(file),
+                    STATX_FLAGS, statxmask, &stx) == 0) {
+            fromstatx(file, &stx, pstat);
+            return 0;
+        }
+        if (errno != ENOSYS) {
+            return -1;
+        }
+        nostatx = true;
+    }
+    return fstatat(file->dirfd, getatpath(file), pstat, AT_SYMLINK_NOFOLLOW);
+#else
+    if (fstatat(file->dirfd, getatpath(file), pstat, AT_SYMLINK_NOFOLLOW) != 0) {
+        return -1;
+    }
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__)
+    file->btime = pstat->st_birthtime;
+#endif
+    return 0;
+#endif
+}
+
+/**
+ * Record the outcome of stat'ing file.
+ *
+ * pstat is the result, or NULL if the stat failed with error.
+ * Takes ownership of pstat.
+ */
+static void setstat(File *file, struct stat *pstat, int error)
+{
+    file->didstat = 1;
+    __atomic_fetch_add(&nstats, 1, __ATOMIC_RELAXED);
+    if (!pstat) {
+        file->staterr = error;
+        return;
+    }
+    file->pstat = pstat;
+    file->type = pstat->st_mode & S_IFMT;
+}
+
+/**
+ * Return true if fetchfile() needs to stat file to get what.
+ */
+static bool needsstat(File *file, unsigned int what)
+{
+    if (file->didstat) {
+        return false;
+    }
+    /* everything else needs the type, at least, and symlinks are
+     * stat'ed on the way to their targets */
+    return (what & FETCH_STAT) || !file->type ||
+           ((what & FETCH_TARGET) && S_ISLNK(file->type)) ||
+           ((what & FETCH_DIRSTAT) && S_ISDIR(file->type));
+}
+
+#ifdef __linux__
+bool getstatxargs(File *file, unsigned int what,
+                  int *dirfd, const char **path, int *flags, unsigned int *mask)
+{
+    if (!file || nostatx || !needsstat(file, what)) {
+        return false;
+    }
+    *dirfd = file->dirfd;
+    *path = getatpath(file);
+    *flags = STATX_FLAGS;
+    *mask = statxmask;
+    return true;
+}
+
+void setstatx(File *file, const struct statx *stx, int error)
+{
+    if (!file) {
+        errorf("file is NULL\n");
+        return;
+    }
+    if (file->didstat) {
+        return;
+    }
+    if (error) {
+        setstat(file, NULL, error);
+        return;
+    }
+    struct stat *pstat = malloc(sizeof(*pstat));
+    if (!pstat) {
+        /* leave it for getstat() to try again */
+        return;
+    }
+    fromstatx(file, stx, pstat);
+    setstat(file, pstat, 0);
+}
+#endif
+
+/**
+ * Stat file if that hasn't been done yet, without reporting errors.
+ *
+ * Returns -1 if there's no memory to do it, else 0.
+ */
+static int fetchstat(File *file)
+{
+    if (file->didstat) {
+        return 0;
+    }
+    struct stat *pstat = malloc(sizeof(*pstat));
+    if (!pstat) {
+        return -1;
+    }
+    errno = 0;
+    if (dostat(file, pstat) != 0) {
+        int error = errno;
+        free(pstat);
+        setstat(file, NULL, error);
+    } else {
+        setstat(file, pstat, 0);
+    }
+    return 0;
+}
+
 /**
  * Fill the pstat field if it's not already populated and return it.
+ *
+ * If the stat failed, the error is reported the first time
+ * the metadata is asked for, even if the stat was done ahead of time
+ * (see setstatx()), so errors come out in the same order either way.
  */
 static struct stat *getstat(File *file)
 {
@@ -226,20 +623,13 @@ static struct stat *getstat(File *file)
         return NULL;
     }
 
-    if (!file->didstat) {
-        struct stat *pstat = malloc(sizeof(*pstat));
-        if (!pstat) {
-            errorf("Out of memory\n");
-            return NULL;
-        }
-        errno = 0;
-        file->didstat = 1;
-        if (lstat(file->path, pstat) != 0) {
-            errorf("Cannot lstat %s: %s\n", file->path, strerror(errno));
-            free(pstat);
-            return NULL;
-        }
-        file->pstat = pstat;
+    if (!file->didstat && fetchstat(file) != 0) {
+        errorf("Out of memory\n");
+        return NULL;
+    }
+    if (file->staterr) {
+        errorf("Cannot lstat %s: %s\n", getpath(file), strerror(file->staterr));
+        file->staterr = 0;
     }
 
     return file->pstat;
@@ -254,16 +644,35 @@ bool isstat(File *file)
     return getstat(file);
 }
 
+/**
+ * Return the S_IFMT bits of file's mode, or 0 if they can't be determined.
+ *
+ * Only stats the file if readdir() didn't tell us the type.
+ */
+static mode_t gettype(File *file)
+{
+    if (!file) {
+        return 0;
+    }
+    if (!file->type) {
+        getstat(file);
+    }
+    return file->type;
+}
+
+bool hastype(File *file)
+{
+    return gettype(file) != 0;
+}
+
 bool isblockdev(File *file)
 {
-    struct stat *pstat = getstat(file);
-    return pstat && S_ISBLK(pstat->st_mode);
+    return S_ISBLK(gettype(file));
 }
 
 bool ischardev(File *file)
 {
-    struct stat *pstat = getstat(file);
-    return pstat && S_ISCHR(pstat->st_mode);
+    return S_ISCHR(gettype(file));
 }
 
 bool isdevice(File *file)
@@ -273,8 +682,7 @@ bool isdevice(File *file)
 
 bool isdir(File *file)
 {
-    struct stat *pstat = getstat(file);
-    return pstat && S_ISDIR(pstat->st_mode);
+    return S_ISDIR(gettype(file));
 }
 
 bool isexec(File *file)
@@ -285,14 +693,12 @@ bool isexec(File *file)
 
 bool isfifo(File *file)
 {
-    struct stat *pstat = getstat(file);
-    return pstat && S_ISFIFO(pstat->st_mode);
+    return S_ISFIFO(gettype(file));
 }
 
 bool islink(File *file)
 {
-    struct stat *pstat = getstat(file);
-    return pstat && S_ISLNK(pstat->st_mode);
+    return S_ISLNK(gettype(file));
 }
 
 bool issetgid(File *file)
@@ -309,8 +715,7 @@ bool issetuid(File *file)
 
 bool issock(File *file)
 {
-    struct stat *pstat = getstat(file);
-    return pstat && S_ISSOCK(pstat->st_mode);
+    return S_ISSOCK(gettype(file));
 }
 
 bool issticky(File *file)
@@ -529,6 +934,54 @@ int comparebyversion(const File **a, const File **b)
     return strverscmp(fa->name, fb->name);
 }
 
+void getsortkey(File *file, file_compare_function compare, SortKey *key)
+{
+    key->name = file->name;
+    key->value = 0;
+    key->missing = false;
+    if (compare == comparebyname || compare == comparebyversion) {
+        return;
+    }
+    if (compare == comparebybtime) {
+        key->value = getbtime(file);
+        key->missing = key->value == 0;
+        return;
+    }
+    struct stat *pstat = getstat(file);
+    if (!pstat) {
+        key->missing = true;
+    } else if (compare == comparebyatime) {
+        key->value = pstat->st_atime;
+    } else if (compare == comparebyctime) {
+        key->value = pstat->st_ctime;
+    } else if (compare == comparebymtime) {
+        key->value = pstat->st_mtime;
+    } else if (compare == comparebyblocks) {
+        key->value = pstat->st_blocks;
+    } else if (compare == comparebysize) {
+        key->value = pstat->st_size;
+    }
+}
+
+int comparesortkeys(const SortKey *a, const SortKey *b, file_compare_function compare)
+{
+    if (compare == comparebyname) {
+        return strcoll(a->name, b->name);
+    }
+    if (compare == comparebyversion) {
+        return strverscmp(a->name, b->name);
+    }
+    /* the same as the compare functions: no value last,
+     * then biggest (or newest) first, then by name */
+    if (a->missing || b->missing) return (a->missing) - (b->missing);
+
+    if (a->value == b->value) {
+        return strcoll(a->name, b->name);
+    } else {
+        return (a->value < b->value) - (a->value > b->value);
+    }
+}
+
 unsigned long getblocks(File *file, int blocksize)
 {
     struct stat *pstat = getstat(file);
@@ -575,24 +1028,10 @@ time_t getatime(File *file)
 
 time_t getbtime(File *file)
 {
-    if (!file) return 0;
-#ifdef __linux__
-    struct statx stx;
-    if (syscall(SYS_statx, AT_FDCWD, file->path,
-                AT_SYMLINK_NOFOLLOW | AT_STATX_SYNC_AS_STAT,
-                STATX_BTIME, &stx) != 0) {
-        errorf("Cannot statx %s: %s\n", file->path, strerror(errno));
-        return 0;
-    }
-    if (!(stx.stx_mask & STATX_BTIME)) {
-        return 0;
-    }
-    return stx.stx_btime.tv_sec;
-#else
+    /* filled in by the same statx() as everything else */
     struct stat *pstat = getstat(file);
     if (!pstat) return 0;
-    return pstat->st_birthtime;
-#endif
+    return file->btime;
 }
 
 time_t getctime(File *file)
@@ -728,11 +1167,27 @@ char *getmodes(File *file)
 /* TODO return a string, "?" on error */
 ino_t getinode(File *file)
 {
+    if (!file) return 0;
+    if (file->pstat) {
+        return file->pstat->st_ino;
+    }
+    if (file->inode && file->type && !S_ISDIR(file->type)) {
+        /* from readdir(), which for a mount point gives the inode of the
+         * directory underneath, so directories are always stat'ed */
+        return file->inode;
+    }
     struct stat *pstat = getstat(file);
     if (!pstat) return 0;
     return pstat->st_ino;
 }
 
+dev_t getdev(File *file)
+{
+    struct stat *pstat = getstat(file);
+    if (!pstat) return 0;
+    return pstat->st_dev;
+}
+
 /* TODO return a string, "?" on error */
 time_t getmtime(File *file)
 {
@@ -747,7 +1202,8 @@ char *getperms(File *file)
     char *unknownperms = "???";
     if (!file) return strdup(unknownperms);
 
-    char *path = file->path;
+    int dirfd = file->dirfd;
+    const char *path = getatpath(file);
     char *perms, *p;
     perms = malloc((strlen(unknownperms) + 1) * sizeof(*perms));
     if (!perms) {
@@ -756,21 +1212,21 @@ char *getperms(File *file)
     }
     p = perms;
 
-    if (access(path, R_OK) == 0)
+    if (faccessat(dirfd, path, R_OK, 0) == 0)
         (*p++) = 'r';
     else if (errno == EACCES)
         (*p++) = '-';
     else
         (*p++) = '?';
 
-    if (access(path, W_OK) == 0)
+    if (faccessat(dirfd, path, W_OK, 0) == 0)
         (*p++) = 'w';
     else if (errno == EACCES)
         (*p++) = '-';
     else
         (*p++) = '?';
 
-    if (access(path, X_OK) == 0)
+    if (faccessat(dirfd, path, X_OK, 0) == 0)
         (*p++) = 'x';
     else if (errno == EACCES)
         (*p++) = '-';
@@ -797,6 +1253,56 @@ long getsize(File *file)
     return (long)pstat->st_size;
 }
 
+/* targeterr value for a target that doesn't fit in our buffer */
+#define ETARGETTOOLONG -1
+
+/**
+ * Read the target of file, which must be a symlink, into file->target.
+ *
+ * Doesn't report errors.  Returns 0 on success, ETARGETTOOLONG,
+ * or an errno value.
+ */
+static int readtarget(File *file)
+{
+    char targetpath[PATH_MAX];
+    errno = 0;
+    int nchars = readlinkat(file->dirfd, getatpath(file), targetpath, sizeof(targetpath)-1);
+    if (nchars == -1) {
+        return errno;
+    } else if (nchars == sizeof(targetpath)-1) {
+        return ETARGETTOOLONG;
+    }
+    targetpath[nchars] = '\0';
+    /* the target is relative to the link's directory, which is also
+     * where dirfd is unless the link was named with a slash */
+    File *target;
+    if (!file->dir || strchr(file->name, '/')) {
+        char *dir = getdirname(file);
+        if (dir == NULL) {
+            return ENOMEM;
+        }
+        target = newfileat(file->dirfd, dir, targetpath);
+        free(dir);
+    } else {
+        target = newfilenode(file->dirfd, file->dir, targetpath);
+    }
+    if (target == NULL) {
+        return ENOMEM;
+    }
+    const char *atpath = getatpath(file);
+    if (file->dirfd != AT_FDCWD && targetpath[0] != '/' && strchr(atpath, '/')) {
+        char *atdircopy = strdup(atpath);
+        target->atname = atdircopy ? makepath(dirname(atdircopy), targetpath) : NULL;
+        free(atdircopy);
+        if (!target->atname) {
+            freefile(target);
+            return ENOMEM;
+        }
+    }
+    file->target = target;
+    return 0;
+}
+
 File *gettarget(File *file)
 {
     if (!file) {
@@ -804,31 +1310,25 @@ File *gettarget(File *file)
         return NULL;
     }
     if (!islink(file)) {
-        errorf("%s is not a symlink\n", file->path);
+        errorf("%s is not a symlink\n", getpath(file));
         return NULL;
     }
     if (!file->target) {
-        char targetpath[PATH_MAX];
-        /* note: readlink(3p) not readlink(2) */
-        errno = 0;
-        int nchars = readlink(file->path, targetpath, sizeof(targetpath)-1);
-        if (nchars == -1) {
-            errorf("Error getting symlink target: %s\n", strerror(errno));
-            return NULL;
-        } else if (nchars == sizeof(targetpath)-1) {
+        /* an error from fetchfile() is reported as if it happened now,
+         * and like any other error, the next call tries again */
+        if (!file->targeterr) {
+            file->targeterr = readtarget(file);
+        }
+        int error = file->targeterr;
+        file->targeterr = 0;
+        if (error == ETARGETTOOLONG) {
             errorf("Symlink target too long for buffer\n");
             return NULL;
-        }
-        targetpath[nchars] = '\0';
-        char *dir = getdirname(file);
-        if (dir == NULL) {
-            errorf("getdirname returned NULL\n");
+        } else if (error == ENOMEM) {
+            errorf("Out of memory\n");
             return NULL;
-        }
-        file->target = newfile(dir, targetpath);
-        free(dir);
-        if (file->target == NULL) {
-            errorf("newfile returned NULL\n");
+        } else if (error) {
+            errorf("Error getting symlink target: %s\n", strerror(error));
             return NULL;
         }
     }
@@ -865,15 +1365,18 @@ File *getfinaltarget(File *file)
 
 /*
  * return true if file has ACLs beyond the traditional Unix owner/group/other ACLs
+ *
+ * doesn't report errors, the first one is stored in *perror (0 if none)
  */
-bool hasacls(File *file)
+static bool readacls(File *file, int *perror)
 {
+    *perror = 0;
 #ifndef HAVE_ACL
     return false;
 #elif defined(__APPLE__)
     /* macOS uses ACL_TYPE_EXTENDED instead of POSIX ACL types */
     errno = 0;
-    acl_t acl = acl_get_file(file->path, ACL_TYPE_EXTENDED);
+    acl_t acl = acl_get_file(getpath(file), ACL_TYPE_EXTENDED);
     if (!acl) {
         if (errno == ENOTSUP) {
             return false;
@@ -886,19 +1389,21 @@ bool hasacls(File *file)
     acl_free(acl);
     return status == 0;
 #else
+    /* there is no acl_get_fileat(), and opening the file to use acl_get_fd()
+     * could have side effects on devices, so this still uses the full path */
     acl_type_t acl_types[] = { ACL_TYPE_ACCESS, ACL_TYPE_DEFAULT };
     for (int i = 0; i < sizeof(acl_types)/sizeof(acl_types[0]); i++) {
-        if (!isdir(file) && acl_types[i] == ACL_TYPE_DEFAULT) continue;
+        if (!S_ISDIR(file->type) && acl_types[i] == ACL_TYPE_DEFAULT) continue;
 
         errno = 0;
-        acl_t acl = acl_get_file(file->path, acl_types[i]);
+        acl_t acl = acl_get_file(getpath(file), acl_types[i]);
         // XXX is this valid?
         if (!acl) {
             if (errno == EOPNOTSUPP) {
                 /* file system does not support ACLs */
                 return false;
             }
-            errorf("Error getting ACLs for %s: %s\n", file->name, strerror(errno));
+            if (!*perror) *perror = errno;
             // error = 1;
             break;
         }
@@ -909,7 +1414,7 @@ bool hasacls(File *file)
             errno = 0;
             int status = acl_get_entry(acl, entry_id, &entry);
             if (status == -1) {
-                errorf("Error getting ACLs for %s: %s\n", file->name, strerror(errno));
+                if (!*perror) *perror = errno;
                 // XXX return -1 or '?' or something
                 //error = 1;
                 break;
@@ -937,4 +1442,45 @@ bool hasacls(File *file)
 #endif
 }
 
+bool hasacls(File *file)
+{
+    if (!file) {
+        errorf("file is NULL\n");
+        return false;
+    }
+    if (file->acls == -1) {
+        /* readacls() needs the type */
+        gettype(file);
+        file->acls = readacls(file, &file->aclerr);
+    }
+    if (file->aclerr) {
+        /* reported every time, as if the lookup was done every time */
+        errorf("Error getting ACLs for %s: %s\n", file->name, strerror(file->aclerr));
+    }
+    return file->acls;
+}
+
+void fetchfile(File *file, unsigned int what)
+{
+    if (!file) {
+        return;
+    }
+    if (needsstat(file, what)) {
+        if (fetchstat(file) != 0) {
+            /* leave the rest for when it's needed */
+            return;
+        }
+    }
+    if ((what & FETCH_TARGET) && S_ISLNK(file->type)
+            && !file->target && !file->targeterr) {
+        file->targeterr = readtarget(file);
+        if (file->target && (what & FETCH_TARGETSTAT)) {
+            fetchstat(file->target);
+        }
+    }
+    if ((what & FETCH_ACLS) && file->pstat && !S_ISLNK(file->type) && file->acls == -1) {
+        file->acls = readacls(file, &file->aclerr);
+    }
+}
+
 /* vim: set ts=4 sw=4 tw=0 et:*/
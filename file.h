@@ -10,8 +10,37 @@
 struct file;
 typedef struct file File;
 
+/* metadata that callers may need, see setstatfields() */
+enum statfield {
+    STAT_NLINK  = 1 << 0,
+    STAT_UID    = 1 << 1,
+    STAT_GID    = 1 << 2,
+    STAT_ATIME  = 1 << 3,
+    STAT_MTIME  = 1 << 4,
+    STAT_CTIME  = 1 << 5,
+    STAT_INO    = 1 << 6,
+    STAT_SIZE   = 1 << 7,
+    STAT_BLOCKS = 1 << 8,
+    STAT_BTIME  = 1 << 9,
+};
+
 typedef int (*file_compare_function)(const File **a, const File **b);
 
+/* what a file sorts by, so it can be sorted without keeping the File */
+typedef struct sortkey {
+    const char *name;
+    long long value;                /* the time or size sorted by, if any */
+    bool missing;                   /* true = there's no value, e.g. the stat failed */
+} SortKey;
+
+/**
+ * Set which metadata (a mask of enum statfield values) will be needed.
+ *
+ * Files are stat'ed once, with a statx() on Linux that asks only for
+ * these fields (the type and mode are always fetched).  Defaults to all.
+ */
+void setstatfields(unsigned int fields);
+
 /**
  * Free any memory held by file.
  */
@@ -22,6 +51,44 @@ void freefile(File *file);
  */
 File *newfile(const char *dir, const char *name);
 
+/**
+ * Create a new File in the directory open as dirfd.
+ *
+ * dir is the path of that directory, used for getpath().
+ * name is looked up relative to dirfd by lstat(), etc.
+ * dirfd may be AT_FDCWD, in which case the full path is used.
+ *
+ * dirfd must stay open until the File is freed.
+ */
+File *newfileat(int dirfd, const char *dir, const char *name);
+
+/**
+ * Create a new File for an entry in dir, which is open as dirfd.
+ *
+ * The File refers to dir's name rather than copying its path,
+ * and so do any other Files in dir.  dir itself may be freed first.
+ *
+ * dirfd must stay open until the File is freed.
+ */
+File *newfilein(int dirfd, File *dir, const char *name);
+
+/**
+ * Open file, which should be a directory, for reading.
+ *
+ * Returns a file descriptor that the caller must close(),
+ * or -1 with errno set on failure.
+ */
+int opendirectory(File *file);
+
+/**
+ * Record the inode number and type that readdir() reported for file.
+ *
+ * type is a DT_* value from <dirent.h>.  Once set, isdir(), islink(),
+ * getinode(), etc. don't need to stat the file.  If type is DT_UNKNOWN,
+ * the type comes from lstat() as usual.
+ */
+void setdirentinfo(File *file, ino_t inode, unsigned char type);
+
 /**
  * Get the name that was supplied when creating the file.
  *
@@ -33,9 +100,17 @@ File *newfile(const char *dir, const char *name);
  */
 const char *getname(File *file);
 
+/**
+ * Return how many directories down file was found from the one it was
+ * named in, e.g. 1 for the entries of a directory named as an argument,
+ * and 0 for a file named on its own.
+ */
+int getdepth(File *file);
+
 /**
  * Get the full path to file, like realpath().
  *
+ * The path is built when it's first asked for and kept until file is freed.
  * Caller should NOT free the returned string.
  *
  * @see realpath()
@@ -68,6 +143,13 @@ char *getdirname(File *file);
 char *makepath(const char *dirname, const char *filename);
 
 bool isstat(File *file);
+/**
+ * Return true if file's type is known.
+ *
+ * Unlike isstat(), this doesn't need to stat the file
+ * if readdir() told us the type.
+ */
+bool hastype(File *file);
 bool isblockdev(File *file);
 bool ischardev(File *file);
 bool isdevice(File *file);
@@ -93,6 +175,10 @@ time_t getbtime(File *file);
 time_t getctime(File *file);
 time_t getmtime(File *file);
 ino_t getinode(File *file);
+/**
+ * Return the device that file is on, 0 if unknown.
+ */
+dev_t getdev(File *file);
 nlink_t getlinkcount(File *file);
 
 /**
@@ -132,6 +218,58 @@ File *gettarget(File *file);
  */
 File *getfinaltarget(File *file);
 
+/* metadata that fetchfile() can get ahead of time */
+enum fetch {
+    FETCH_STAT       = 1 << 0,  /* lstat() the file */
+    FETCH_TARGET     = 1 << 1,  /* readlink() if it's a symlink */
+    FETCH_TARGETSTAT = 1 << 2,  /* also lstat() the target, with FETCH_TARGET */
+    FETCH_ACLS       = 1 << 3,  /* look for extended ACLs */
+    FETCH_DIRSTAT    = 1 << 4,  /* lstat() the file if it's a directory */
+};
+
+/**
+ * Get some of file's metadata now, a mask of enum fetch values,
+ * rather than when it's first needed.
+ *
+ * Doesn't report errors.  They are reported when the metadata is
+ * first used, as if it was being fetched then, so the output is
+ * the same either way.
+ *
+ * Different files can be fetched at the same time on different threads,
+ * as long as nothing else is using them.
+ */
+void fetchfile(File *file, unsigned int what);
+
+#ifdef __linux__
+struct statx;
+
+/**
+ * Get the arguments for a statx() of file, so it can be done elsewhere,
+ * e.g. in a batch with other files.  Pass the result to setstatx().
+ *
+ * Returns false if file doesn't need it to fetch what (a mask of
+ * enum fetch values), e.g. it has already been stat'ed.
+ */
+bool getstatxargs(File *file, unsigned int what,
+                  int *dirfd, const char **path, int *flags, unsigned int *mask);
+
+/**
+ * Record the result of a statx() done elsewhere.
+ *
+ * error is 0 if stx holds the result, otherwise the errno value.
+ * Errors are reported later, when the metadata is first needed,
+ * as if the file was being stat'ed then.
+ */
+void setstatx(File *file, const struct statx *stx, int error);
+#endif
+
+/**
+ * Return the number of times lstat() or similar has been called on any File.
+ *
+ * For tests and diagnostics.
+ */
+unsigned long getstatcount(void);
+
 int comparebyname(const File **a, const File **b);
 int comparebyatime(const File **a, const File **b);
 int comparebybtime(const File **a, const File **b);
@@ -141,5 +279,18 @@ int comparebyblocks(const File **a, const File **b);
 int comparebysize(const File **a, const File **b);
 int comparebyversion(const File **a, const File **b);
 
+/**
+ * Fill in *key with what compare, one of the functions above, sorts file by.
+ *
+ * key->name points into file.
+ */
+void getsortkey(File *file, file_compare_function compare, SortKey *key);
+
+/**
+ * Compare keys from getsortkey(), in the same order compare would
+ * put their files in.
+ */
+int comparesortkeys(const SortKey *a, const SortKey *b, file_compare_function compare);
+
 #endif
 /* vim: set ts=4 sw=4 tw=0 et:*/
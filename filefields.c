@@ -1,6 +1,7 @@
 #define _XOPEN_SOURCE 600
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,10 +15,16 @@
 #include "logging.h"
 #include "options.h"
 #include "string.h"
+#include "treesize.h"
 #include "user.h"
 
 char *humanbytes(unsigned long bytes);
-void printnametobuf(File *file, Options *options, Buf *buf);
+void printnametobuf(File *file, const char *name, Options *options, Buf *buf);
+
+/* protects options->usernames and options->groupnames, and the
+ * getpwuid() and getgrgid() calls that fill them in, since
+ * directories may be listed on several threads */
+static pthread_mutex_t namelock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * Dynamically allocate a formatted string (portable asprintf replacement).
@@ -56,6 +63,17 @@ static char *xstrftime(const char *fmt, const struct tm *tm)
     }
 }
 
+/**
+ * Return the number of fields getfilefields() makes for each file.
+ */
+static unsigned countfilefields(Options *options)
+{
+    /* the name, and two for --tree-size */
+    return 1 + options->size + 2 * options->treesize + options->inode +
+           options->modes + options->linkcount + options->owner + options->group +
+           options->perms + options->bytes + options->datetime;
+}
+
 FieldList *getfilefields(File *file, Options *options)
 {
     if (file == NULL) {
@@ -63,7 +81,7 @@ FieldList *getfilefields(File *file, Options *options)
         return NULL;
     }
 
-    List *fieldlist = newlist();
+    List *fieldlist = newlistcap(countfilefields(options));
     if (fieldlist == NULL) {
         errorf("fieldlist is NULL\n");
         return NULL;
@@ -90,6 +108,17 @@ FieldList *getfilefields(File *file, Options *options)
         append(field, fieldlist);
     }
 
+    if (options->treesize) {
+        /* the file's blocks and entries, from one walk */
+        TreeSize size = gettreesize(file, options);
+        Field *field = gettreeblocksfield(&size, options);
+        if (!field) goto error;
+        append(field, fieldlist);
+        field = gettreeentriesfield(&size, options);
+        if (!field) goto error;
+        append(field, fieldlist);
+    }
+
     if (options->inode) {
         Field *field = getinodefield(file, options);
         if (!field) goto error;
@@ -194,7 +223,8 @@ Field *getdatetimefield(File *file, Options *options)
             timestamp = getmtime(file);
             break;
         }
-        struct tm *timestruct = localtime(&timestamp);
+        struct tm tm;
+        struct tm *timestruct = localtime_r(&timestamp, &tm);
         if (!timestruct) {
             errorf("timestruct is NULL\n");
             return NULL;
@@ -243,29 +273,38 @@ Field *getdatetimefield(File *file, Options *options)
     return field;
 }
 
-Field *getgroupfield(File *file, Options *options)
+char *lookupgroupname(gid_t gid, Options *options)
 {
-    char *s;
-    if (isstat(file)) {
-        gid_t gid = getgroupnum(file);
-        if (options->numeric) {
-            s = xasprintf("%lu", (unsigned long)gid);
-        } else {
-            char *groupname = get(options->groupnames, gid);
+    if (options->numeric) {
+        return xasprintf("%lu", (unsigned long)gid);
+    }
+    pthread_mutex_lock(&namelock);
+    char *groupname = get(options->groupnames, gid);
+    if (!groupname) {
+        groupname = getgroupname(gid);
+        if (!groupname) {
+            groupname = xasprintf("%lu", (unsigned long)gid);
             if (!groupname) {
-                groupname = getgroupname(gid);
-                if (!groupname) {
-                    groupname = xasprintf("%lu", (unsigned long)gid);
-                    if (!groupname) return NULL;
-                    set(options->groupnames, gid, groupname);
-                    free(groupname);
-                } else {
-                    set(options->groupnames, gid, groupname);
-                }
-                groupname = get(options->groupnames, gid);
+                pthread_mutex_unlock(&namelock);
+                return NULL;
             }
-            s = xasprintf("%s", groupname);
+            set(options->groupnames, gid, groupname);
+            free(groupname);
+        } else {
+            set(options->groupnames, gid, groupname);
         }
+        groupname = get(options->groupnames, gid);
+    }
+    char *s = xasprintf("%s", groupname);
+    pthread_mutex_unlock(&namelock);
+    return s;
+}
+
+Field *getgroupfield(File *file, Options *options)
+{
+    char *s;
+    if (isstat(file)) {
+        s = lookupgroupname(getgroupnum(file), options);
     } else {
         s = xasprintf("?");
     }
@@ -278,9 +317,9 @@ Field *getgroupfield(File *file, Options *options)
 Field *getinodefield(File *file, Options *options)
 {
     char *s;
-    if (isstat(file)) {
-        ino_t inode = getinode(file);
-        s = xasprintf("%lu", inode);
+    /* readdir() usually tells us the inode number without a stat */
+    if (file && (getinode(file) != 0 || isstat(file))) {
+        s = xasprintf("%lu", getinode(file));
     } else {
         s = xasprintf("?");
     }
@@ -349,7 +388,7 @@ Field *getnamefield(File *file, Options *options)
     }
 
     /* print the file itself... */
-    printnametobuf(file, options, buf);
+    printnametobuf(file, options->fullpaths ? getpath(file) : getname(file), options, buf);
 
     if (options->showlinks) {
         Map *linkmap = newmap();
@@ -366,7 +405,7 @@ Field *getnamefield(File *file, Options *options)
                 }
                 file = gettarget(file);
                 bufappend(buf, " -> ", 4, 4);
-                printnametobuf(file, options, buf);
+                printnametobuf(file, getname(file), options, buf);
             }
             freemap(linkmap);
         } else {
@@ -377,7 +416,7 @@ Field *getnamefield(File *file, Options *options)
         if (isstat(file) && islink(file)) {
             file = gettarget(file);
             bufappend(buf, " -> ", 4, 4);
-            printnametobuf(file, options, buf);
+            printnametobuf(file, getname(file), options, buf);
         }
     }
 
@@ -395,29 +434,38 @@ Field *getnamefield(File *file, Options *options)
     return field;
 }
 
-Field *getownerfield(File *file, Options *options)
+char *lookupusername(uid_t uid, Options *options)
 {
-    char *s;
-    if (isstat(file)) {
-        uid_t uid = getownernum(file);
-        if (options->numeric) {
-            s = xasprintf("%lu", (unsigned long)uid);
-        } else {
-            char *username = get(options->usernames, uid);
+    if (options->numeric) {
+        return xasprintf("%lu", (unsigned long)uid);
+    }
+    pthread_mutex_lock(&namelock);
+    char *username = get(options->usernames, uid);
+    if (!username) {
+        username = getusername(uid);
+        if (!username) {
+            username = xasprintf("%lu", (unsigned long)uid);
             if (!username) {
-                username = getusername(uid);
-                if (!username) {
-                    username = xasprintf("%lu", (unsigned long)uid);
-                    if (!username) return NULL;
-                    set(options->usernames, uid, username);
-                    free(username);
-                } else {
-                    set(options->usernames, uid, username);
-                }
-                username = get(options->usernames, uid);
+                pthread_mutex_unlock(&namelock);
+                return NULL;
             }
-            s = xasprintf("%s", username);
+            set(options->usernames, uid, username);
+            free(username);
+        } else {
+            set(options->usernames, uid, username);
         }
+        username = get(options->usernames, uid);
+    }
+    char *s = xasprintf("%s", username);
+    pthread_mutex_unlock(&namelock);
+    return s;
+}
+
+Field *getownerfield(File *file, Options *options)
+{
+    char *s;
+    if (isstat(file)) {
+        s = lookupusername(getownernum(file), options);
     } else {
         s = xasprintf("?");
     }
@@ -465,7 +513,37 @@ Field *getsizefield(File *file, Options *options)
     return field;
 }
 
-void printnametobuf(File *file, Options *options, Buf *buf)
+Field *gettreeblocksfield(TreeSize *size, Options *options)
+{
+    char *s;
+    if (size->entries == 0) {
+        s = xasprintf("?");
+    } else if (options->sizestyle == SIZE_HUMAN) {
+        s = humanbytes(size->blocks * options->blocksize);
+    } else {
+        s = xasprintf("%lu", size->blocks);
+    }
+    if (!s) return NULL;
+    Field *field = newfield(s, ALIGN_RIGHT, strlen(s));
+    free(s);
+    return field;
+}
+
+Field *gettreeentriesfield(TreeSize *size, Options *options)
+{
+    char *s;
+    if (size->entries == 0) {
+        s = xasprintf("?");
+    } else {
+        s = xasprintf("%lu", size->entries);
+    }
+    if (!s) return NULL;
+    Field *field = newfield(s, ALIGN_RIGHT, strlen(s));
+    free(s);
+    return field;
+}
+
+void printnametobuf(File *file, const char *name, Options *options, Buf *buf)
 {
     assert(file != NULL);
     assert(options != NULL);
@@ -480,7 +558,7 @@ void printnametobuf(File *file, Options *options, Buf *buf)
     case FLAGS_NORMAL:
         break;
     case FLAGS_OLD:
-        if (!isstat(file))
+        if (!hastype(file))
             bufappend(buf, "?", 1, 1);
         else if (isdir(file))
             bufappend(buf, "[", 1, 1);
@@ -499,7 +577,7 @@ void printnametobuf(File *file, Options *options, Buf *buf)
     /* TODO change this to something like setcolor(COLOR_BLUE) */
     int colorused = 0;
     if (options->color) {
-        if (!isstat(file)) {
+        if (!hastype(file)) {
             bufappend(buf, options->colors->red, strlen(options->colors->red), 0);
             colorused = 1;
         } else if (isdir(file)) {
@@ -514,7 +592,6 @@ void printnametobuf(File *file, Options *options, Buf *buf)
         }
     }
 
-    const char *name = getname(file);
     printtobuf(name, options->escape, buf);
     /* don't free name */
 
@@ -526,7 +603,7 @@ void printnametobuf(File *file, Options *options, Buf *buf)
     /* print a character after the file showing its type (-F and -O) */
     switch (options->flags) {
     case FLAGS_NORMAL:
-        if (!isstat(file))
+        if (!hastype(file))
             bufappend(buf, "?", 1, 1);
         else if (isdir(file))
             bufappend(buf, "/", 1, 1);
@@ -542,7 +619,7 @@ void printnametobuf(File *file, Options *options, Buf *buf)
             bufappend(buf, " ", 1, 1);
         break;
     case FLAGS_OLD:
-        if (!isstat(file))
+        if (!hastype(file))
             bufappend(buf, "?", 1, 1);
         else if (isdir(file))
             bufappend(buf, "]", 1, 1);
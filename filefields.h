@@ -5,6 +5,7 @@
 #include "file.h"
 #include "list.h"
 #include "options.h"
+#include "treesize.h"
 
 typedef List FieldList;             /* list of fields for a single file */
 
@@ -25,7 +26,22 @@ Field *getnamefield(File *file, Options *options);
 Field *getownerfield(File *file, Options *options);
 Field *getpermsfield(File *file, Options *options);
 Field *getsizefield(File *file, Options *options);
+Field *gettreeblocksfield(TreeSize *size, Options *options);
+Field *gettreeentriesfield(TreeSize *size, Options *options);
 
 char *humanbytes(unsigned long bytes);
 
+/**
+ * Return the name of the user uid, or its number with -n or if it has none.
+ *
+ * Names are looked up once and kept in options->usernames.
+ * Caller must free returned string.
+ */
+char *lookupusername(uid_t uid, Options *options);
+
+/**
+ * Like lookupusername(), for the group gid and options->groupnames.
+ */
+char *lookupgroupname(gid_t gid, Options *options);
+
 #endif
\ No newline at end of file
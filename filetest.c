@@ -1,14 +1,18 @@
-#define _XOPEN_SOURCE 600
+#define _XOPEN_SOURCE 700   /* for mkdtemp() */
+#define _DEFAULT_SOURCE     /* for DT_UNKNOWN */
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "dir.h"
 #include "file.h"
 #include "logging.h"
 
@@ -16,9 +20,11 @@ int test_bare_file();
 int test_absolute_file();
 int test_relative_file();
 int test_dot();
+int test_file_in_dir();
 int test_filename();
 int test_fileperms();
 int test_device_numbers();
+int test_dirent_info_avoids_stat();
 
 int main(int argc, char **argv)
 {
@@ -28,9 +34,11 @@ int main(int argc, char **argv)
     test_absolute_file();
     test_relative_file();
     test_dot();
+    test_file_in_dir();
     test_filename();
     test_fileperms();
     test_device_numbers();
+    test_dirent_info_avoids_stat();
     return 0;
 }
 
@@ -95,6 +103,27 @@ int test_dot(void)
     return 0;
 }
 
+int test_file_in_dir(void)
+{
+    errorf("\n");   /* prints the function name */
+    File *top = newfile("", "/tmp");
+    File *dir = newfilein(AT_FDCWD, top, "dir");
+    File *file = newfilein(AT_FDCWD, dir, "file");
+    File *sibling = newfilein(AT_FDCWD, dir, "sibling");
+    /* the files keep what they need of their directories */
+    freefile(top);
+    freefile(dir);
+    assert(strcmp(getname(file), "file") == 0);
+    assert(strcmp(getpath(file), "/tmp/dir/file") == 0);
+    assert(strcmp(getpath(sibling), "/tmp/dir/sibling") == 0);
+    char *dirname = getdirname(file);
+    assert(strcmp(dirname, "/tmp/dir") == 0);
+    free(dirname);
+    freefile(file);
+    freefile(sibling);
+    return 0;
+}
+
 int test_filename(void)
 {
     errorf("\n");   /* prints the function name */
@@ -166,3 +195,70 @@ int test_device_numbers(void)
 
     return 0;
 }
+
+int test_dirent_info_avoids_stat(void)
+{
+    errorf("\n");   /* prints the function name */
+    char tempdirname[L_tmpnam];
+    strcpy(tempdirname, "/tmp/filetestXXXXXX");
+    assert(mkdtemp(tempdirname) != NULL);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/file", tempdirname);
+    int fd = open(path, O_CREAT|O_WRONLY, 0644);
+    assert(fd > 0);
+    close(fd);
+    snprintf(path, sizeof(path), "%s/subdir", tempdirname);
+    assert(mkdir(path, 0755) == 0);
+    snprintf(path, sizeof(path), "%s/link", tempdirname);
+    assert(symlink("file", path) == 0);
+
+    int dirfd = open(tempdirname, O_RDONLY | O_DIRECTORY);
+    assert(dirfd >= 0);
+    DirReader *reader = newdirreader(dirfd, DIRBUFSIZE);
+    assert(reader != NULL);
+    const DirEntry *entry;
+    int nfiles = 0;
+    while ((entry = readdirentry(reader)) != NULL) {
+        if (entry->name[0] == '.') continue;
+        nfiles++;
+        File *file = newfileat(dirfd, tempdirname, entry->name);
+        setdirentinfo(file, entry->inode, entry->type);
+
+        unsigned long before = getstatcount();
+        bool dir = isdir(file);
+        bool link = islink(file);
+        ino_t inode = getinode(file);
+        if (entry->type != DT_UNKNOWN && entry->type != DT_DIR) {
+            assert(getstatcount() == before);
+        } else {
+            /* a directory's inode comes from a stat, in case it's a mount point */
+            assert(getstatcount() - before <= 1);
+        }
+        assert(dir == (strcmp(entry->name, "subdir") == 0));
+        assert(link == (strcmp(entry->name, "link") == 0));
+        assert(inode == entry->inode);
+
+        /* anything else still needs a stat, but only one */
+        before = getstatcount();
+        assert(isstat(file));
+        getlinkcount(file);
+        getmtime(file);
+        assert(getstatcount() - before <= 1);
+        assert(getinode(file) == inode);
+        freefile(file);
+    }
+    freedirreader(reader);
+    close(dirfd);
+    assert(nfiles == 3);
+
+    snprintf(path, sizeof(path), "%s/link", tempdirname);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/subdir", tempdirname);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/file", tempdirname);
+    unlink(path);
+    rmdir(tempdirname);
+
+    return 0;
+}
@@ -0,0 +1,674 @@
+#define _POSIX_C_SOURCE 200809L /* for open_memstream(), strdup() */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jobs.h"
+#include "list.h"
+#include "logging.h"
+
+/* default for setqueuedepth(), per thread: finished jobs that can wait to be
+ * output before threads pause, which bounds the memory used by buffered output */
+#define BUFFERED_PER_THREAD 8
+
+enum jobstate { JOB_QUEUED, JOB_RUNNING, JOB_DONE };
+
+/* an error message, and how much of the job's output came before it */
+typedef struct errormark {
+    size_t outpos;
+    char *message;
+} ErrorMark;
+
+/* a buffered job's output, handed to the writer thread, see handoff() */
+typedef struct output {
+    char *out;
+    size_t outsize;
+    List *errors;                   /* ErrorMark *, NULL if none */
+    bool begun;                     /* see Job */
+    int errorsbefore;               /* see Job */
+    bool write;                     /* false = only to be freed, since the jobs were stopped first */
+    struct output *next;            /* in jobs->towrite */
+} Output;
+
+struct job {
+    Jobs *jobs;
+    void *arg;
+    free_func freearg;
+    List *subjobs;                  /* Job *, in output order, NULL if none */
+    enum jobstate state;
+    bool direct;                    /* true = ran on the output thread, output is already written */
+    bool begun;                     /* true = beginoutput() was called */
+    bool last;                      /* true = stopjobs() was called */
+    int errorsbefore;               /* errors captured before beginoutput() */
+    struct job *prev, *next;        /* neighbours in jobs->queue while queued */
+
+    /* output of a job run on another thread */
+    FILE *outstream;                /* while running */
+    char *out;
+    size_t outsize;
+    List *errors;                   /* ErrorMark *, NULL if none */
+};
+
+struct jobs {
+    job_func func;
+    void *context;
+    List *toplevel;                 /* Job *, in output order */
+    const char *separator;          /* see setseparator(), NULL if none */
+    bool started;                   /* true = something has been output, only used by the output thread */
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;            /* signalled when a job is queued or there's room to buffer one */
+    pthread_cond_t done;            /* signalled when a job finishes, or some output is written */
+    pthread_cond_t written;         /* signalled when there's output for the writer */
+    pthread_t *threads;
+    int maxthreads;                 /* not counting the output thread */
+    int nthreads;                   /* started */
+    pthread_t writer;               /* writes buffered output, with worker threads */
+    bool haswriter;                 /* true = writer was started */
+
+    /* protected by lock */
+    Job *queue;                     /* jobs that haven't started, next to start first */
+    int nbuffered;                  /* jobs running or finished buffered, not yet written */
+    int maxbuffered;                /* see setqueuedepth() */
+    Output *towrite, *lastwrite;    /* handed to the writer, first first */
+    int nwriting;                   /* handed to the writer and not yet written */
+    bool stopping;                  /* true = freejobs() wants the threads to exit */
+    bool stopped;                   /* true = no more jobs are to be run or output */
+    bool writefailed;               /* true = the writer found stdout can't be written to */
+};
+
+static void nofree(void *ignored)
+{}
+
+static Job *newjob(Jobs *jobs, void *arg, free_func freearg)
+{
+    Job *job = malloc(sizeof(*job));
+    if (!job) {
+        errorf("Out of memory\n");
+        return NULL;
+    }
+    memset(job, 0, sizeof(*job));
+    job->jobs = jobs;
+    job->arg = arg;
+    job->freearg = freearg;
+    job->state = JOB_QUEUED;
+    return job;
+}
+
+static void freeerrormark(ErrorMark *mark)
+{
+    free(mark->message);
+    free(mark);
+}
+
+/**
+ * Free job, once it and its subjobs have been output.
+ */
+static void freejob(Job *job)
+{
+    if (job->freearg) {
+        job->freearg(job->arg);
+    }
+    /* the subjobs themselves have already been freed */
+    freelist(job->subjobs, nofree);
+    freelist(job->errors, (free_func)freeerrormark);
+    free(job->out);
+    free(job);
+}
+
+/* queue operations, the caller must hold jobs->lock */
+
+static void queuefirst(Jobs *jobs, Job *job)
+{
+    job->prev = NULL;
+    job->next = jobs->queue;
+    if (jobs->queue) {
+        jobs->queue->prev = job;
+    }
+    jobs->queue = job;
+}
+
+static void unqueue(Jobs *jobs, Job *job)
+{
+    if (job->prev) {
+        job->prev->next = job->next;
+    } else {
+        jobs->queue = job->next;
+    }
+    if (job->next) {
+        job->next->prev = job->prev;
+    }
+    job->prev = job->next = NULL;
+}
+
+/**
+ * Queue jobs in list ahead of everything else, in list order.
+ */
+static void queuelist(Jobs *jobs, List *list)
+{
+    if (!list) return;
+    for (int i = length(list) - 1; i >= 0; i--) {
+        queuefirst(jobs, getitem(list, i));
+    }
+}
+
+/**
+ * Mark job as done, and queue its subjobs.
+ *
+ * They go ahead of anything already queued, since they come next
+ * in the output, so the running jobs stay close to the output.
+ */
+static void finishjob(Jobs *jobs, Job *job)
+{
+    job->state = JOB_DONE;
+    if (job->subjobs && length(job->subjobs) > 0) {
+        queuelist(jobs, job->subjobs);
+        pthread_cond_broadcast(&jobs->work);
+    }
+    pthread_cond_broadcast(&jobs->done);
+}
+
+static void captureerror(const char *message, void *context)
+{
+    Job *job = context;
+    ErrorMark *mark = malloc(sizeof(*mark));
+    if (!mark) {
+        /* better out of order than lost */
+        fputs(message, stderr);
+        return;
+    }
+    fflush(job->outstream);
+    mark->outpos = job->outsize;
+    mark->message = strdup(message);
+    if (!job->errors) {
+        job->errors = newlist();
+    }
+    if (!mark->message || !job->errors) {
+        fputs(message, stderr);
+        free(mark->message);
+        free(mark);
+        return;
+    }
+    append(mark, job->errors);
+}
+
+/**
+ * Run job on a thread other than the output thread.
+ */
+static void runbuffered(Jobs *jobs, Job *job)
+{
+    job->outstream = open_memstream(&job->out, &job->outsize);
+    if (!job->outstream) {
+        errorf("Out of memory\n");
+        return;
+    }
+    seterrorhandler(captureerror, job);
+    jobs->func(job, job->arg, job->outstream, jobs->context);
+    seterrorhandler(NULL, NULL);
+    fclose(job->outstream);
+    job->outstream = NULL;
+}
+
+/**
+ * Write the separator if something has been output already,
+ * when a job is about to write something.
+ */
+static void separate(Jobs *jobs, FILE *out)
+{
+    if (jobs->started && jobs->separator) {
+        fputs(jobs->separator, out);
+    }
+    jobs->started = true;
+}
+
+void beginoutput(Job *job, FILE *out)
+{
+    if (!job) {
+        errorf("job is NULL\n");
+        return;
+    }
+    if (job->begun) {
+        return;
+    }
+    job->begun = true;
+    if (job->direct) {
+        /* everything before this job has been output */
+        separate(job->jobs, out);
+    } else {
+        /* until it's output, we don't know what comes before,
+         * so leave it to writebuffered() */
+        job->errorsbefore = job->errors ? length(job->errors) : 0;
+    }
+}
+
+/**
+ * Write the output of a job that was run by runbuffered(),
+ * with its error messages where they came up.
+ */
+static void writebuffered(Jobs *jobs, Output *output)
+{
+    size_t pos = 0;
+    int nerrors = output->errors ? length(output->errors) : 0;
+    if (output->begun && output->errorsbefore == 0) {
+        separate(jobs, stdout);
+    }
+    for (int i = 0; i < nerrors; i++) {
+        ErrorMark *mark = getitem(output->errors, i);
+        fwrite(output->out + pos, 1, mark->outpos - pos, stdout);
+        pos = mark->outpos;
+        fputs(mark->message, stderr);
+        if (output->begun && output->errorsbefore == i + 1) {
+            separate(jobs, stdout);
+        }
+    }
+    if (output->out) {
+        fwrite(output->out + pos, 1, output->outsize - pos, stdout);
+    }
+}
+
+static void freeoutput(Output *output)
+{
+    freelist(output->errors, (free_func)freeerrormark);
+    free(output->out);
+    free(output);
+}
+
+/**
+ * Write, or throw away, output, taken from a job, and free it.
+ *
+ * Called on the writer thread if there is one, else the output thread.
+ * jobs->lock must not be held.
+ */
+static void writeoutput(Jobs *jobs, Output *output)
+{
+    pthread_mutex_lock(&jobs->lock);
+    bool write = output->write && !jobs->writefailed;
+    pthread_mutex_unlock(&jobs->lock);
+
+    if (write) {
+        writebuffered(jobs, output);
+    }
+    freeoutput(output);
+    bool failed = write && ferror(stdout);
+
+    pthread_mutex_lock(&jobs->lock);
+    if (failed) {
+        /* if no one is reading, there's no point carrying on */
+        jobs->writefailed = true;
+        jobs->stopped = true;
+    }
+    jobs->nbuffered--;
+    pthread_cond_signal(&jobs->work);
+    pthread_mutex_unlock(&jobs->lock);
+}
+
+/**
+ * Drain jobs->towrite, in order, while the output thread carries on
+ * with the jobs after them.
+ */
+static void *writer(void *arg)
+{
+    Jobs *jobs = arg;
+
+    pthread_mutex_lock(&jobs->lock);
+    for (;;) {
+        while (!jobs->stopping && !jobs->towrite) {
+            pthread_cond_wait(&jobs->written, &jobs->lock);
+        }
+        if (!jobs->towrite) {
+            break;
+        }
+        Output *output = jobs->towrite;
+        jobs->towrite = output->next;
+        if (!jobs->towrite) {
+            jobs->lastwrite = NULL;
+        }
+        pthread_mutex_unlock(&jobs->lock);
+
+        writeoutput(jobs, output);
+
+        pthread_mutex_lock(&jobs->lock);
+        jobs->nwriting--;
+        pthread_cond_broadcast(&jobs->done);
+    }
+    pthread_mutex_unlock(&jobs->lock);
+    return NULL;
+}
+
+/**
+ * Take the output of job, which ran buffered, and write it, or with a
+ * writer thread, queue it to be written after what's already queued.
+ *
+ * write is false if the jobs were stopped before job was output.
+ */
+static void handoff(Jobs *jobs, Job *job, bool write)
+{
+    Output *output = malloc(sizeof(*output));
+    if (!output) {
+        /* better unbuffered than lost */
+        errorf("Out of memory\n");
+        pthread_mutex_lock(&jobs->lock);
+        while (jobs->nwriting > 0) {
+            pthread_cond_wait(&jobs->done, &jobs->lock);
+        }
+        pthread_mutex_unlock(&jobs->lock);
+        Output stackoutput = { job->out, job->outsize, job->errors, job->begun,
+                               job->errorsbefore, write, NULL };
+        if (write) {
+            writebuffered(jobs, &stackoutput);
+        }
+        pthread_mutex_lock(&jobs->lock);
+        jobs->nbuffered--;
+        pthread_cond_signal(&jobs->work);
+        pthread_mutex_unlock(&jobs->lock);
+        return;
+    }
+    output->out = job->out;
+    output->outsize = job->outsize;
+    output->errors = job->errors;
+    output->begun = job->begun;
+    output->errorsbefore = job->errorsbefore;
+    output->write = write;
+    output->next = NULL;
+    job->out = NULL;
+    job->errors = NULL;
+
+    if (!jobs->haswriter) {
+        writeoutput(jobs, output);
+        return;
+    }
+    pthread_mutex_lock(&jobs->lock);
+    if (jobs->lastwrite) {
+        jobs->lastwrite->next = output;
+    } else {
+        jobs->towrite = output;
+    }
+    jobs->lastwrite = output;
+    jobs->nwriting++;
+    pthread_cond_signal(&jobs->written);
+    pthread_mutex_unlock(&jobs->lock);
+}
+
+static void *worker(void *arg)
+{
+    Jobs *jobs = arg;
+
+    pthread_mutex_lock(&jobs->lock);
+    for (;;) {
+        while (!jobs->stopping && (!jobs->queue || jobs->nbuffered >= jobs->maxbuffered)) {
+            pthread_cond_wait(&jobs->work, &jobs->lock);
+        }
+        if (jobs->stopping) {
+            break;
+        }
+        Job *job = jobs->queue;
+        unqueue(jobs, job);
+        job->state = JOB_RUNNING;
+        jobs->nbuffered++;
+        bool skip = jobs->stopped;
+        pthread_mutex_unlock(&jobs->lock);
+
+        if (!skip) {
+            runbuffered(jobs, job);
+        }
+
+        pthread_mutex_lock(&jobs->lock);
+        finishjob(jobs, job);
+    }
+    pthread_mutex_unlock(&jobs->lock);
+    return NULL;
+}
+
+Jobs *newjobs(int nthreads, job_func func, void *context)
+{
+    if (!func) {
+        errorf("func is NULL\n");
+        return NULL;
+    }
+    Jobs *jobs = malloc(sizeof(*jobs));
+    if (!jobs) {
+        errorf("Out of memory\n");
+        return NULL;
+    }
+    memset(jobs, 0, sizeof(*jobs));
+    jobs->toplevel = newlist();
+    if (!jobs->toplevel) {
+        free(jobs);
+        return NULL;
+    }
+    jobs->func = func;
+    jobs->context = context;
+    jobs->maxthreads = nthreads > 1 ? nthreads - 1 : 0;
+    jobs->maxbuffered = (jobs->maxthreads > 0 ? jobs->maxthreads : 1) * BUFFERED_PER_THREAD;
+    pthread_mutex_init(&jobs->lock, NULL);
+    pthread_cond_init(&jobs->work, NULL);
+    pthread_cond_init(&jobs->done, NULL);
+    pthread_cond_init(&jobs->written, NULL);
+    return jobs;
+}
+
+void freejobs(Jobs *jobs)
+{
+    if (!jobs) return;
+
+    pthread_mutex_lock(&jobs->lock);
+    jobs->stopping = true;
+    pthread_cond_broadcast(&jobs->work);
+    pthread_cond_broadcast(&jobs->written);
+    pthread_mutex_unlock(&jobs->lock);
+    for (int i = 0; i < jobs->nthreads; i++) {
+        pthread_join(jobs->threads[i], NULL);
+    }
+    if (jobs->haswriter) {
+        pthread_join(jobs->writer, NULL);
+    }
+
+    /* anything never run, e.g. runjobs() wasn't called */
+    int ntoplevel = length(jobs->toplevel);
+    for (int i = 0; i < ntoplevel; i++) {
+        Job *job = getitem(jobs->toplevel, i);
+        if (job->state == JOB_QUEUED) {
+            freejob(job);
+        }
+    }
+    freelist(jobs->toplevel, nofree);
+    pthread_cond_destroy(&jobs->written);
+    pthread_cond_destroy(&jobs->done);
+    pthread_cond_destroy(&jobs->work);
+    pthread_mutex_destroy(&jobs->lock);
+    free(jobs->threads);
+    free(jobs);
+}
+
+void setseparator(Jobs *jobs, const char *separator, bool started)
+{
+    if (!jobs) {
+        errorf("jobs is NULL\n");
+        return;
+    }
+    jobs->separator = separator;
+    jobs->started = started;
+}
+
+void setqueuedepth(Jobs *jobs, int depth)
+{
+    if (!jobs) {
+        errorf("jobs is NULL\n");
+        return;
+    }
+    if (depth < 1) {
+        errorf("depth is less than 1\n");
+        return;
+    }
+    jobs->maxbuffered = depth;
+}
+
+void addjob(Jobs *jobs, void *arg, free_func freearg)
+{
+    if (!jobs) {
+        errorf("jobs is NULL\n");
+        return;
+    }
+    Job *job = newjob(jobs, arg, freearg);
+    if (!job) {
+        return;
+    }
+    append(job, jobs->toplevel);
+}
+
+void addsubjob(Job *parent, void *arg, free_func freearg)
+{
+    if (!parent) {
+        errorf("parent is NULL\n");
+        return;
+    }
+    Job *job = newjob(parent->jobs, arg, freearg);
+    if (!job) {
+        return;
+    }
+    /* only the thread running parent touches this until parent is done */
+    if (!parent->subjobs) {
+        parent->subjobs = newlist();
+        if (!parent->subjobs) {
+            freejob(job);
+            return;
+        }
+    }
+    append(job, parent->subjobs);
+}
+
+void stopjobs(Job *job)
+{
+    if (!job) {
+        errorf("job is NULL\n");
+        return;
+    }
+    /* jobs before this one in the output may still be running,
+     * so it takes effect once this one has been output */
+    job->last = true;
+}
+
+bool jobsstopped(Job *job)
+{
+    if (!job) {
+        errorf("job is NULL\n");
+        return false;
+    }
+    pthread_mutex_lock(&job->jobs->lock);
+    bool stopped = job->jobs->stopped;
+    pthread_mutex_unlock(&job->jobs->lock);
+    return stopped;
+}
+
+/**
+ * Wait for job to finish, running it here if it hasn't started,
+ * and output it and then its subjobs.
+ *
+ * A job run here writes straight to stdout if everything before it has
+ * been written, else, while the writer catches up, it's buffered too.
+ *
+ * Once the jobs are stopped, they're only waited for and freed.
+ */
+static void outputjob(Jobs *jobs, Job *job)
+{
+    pthread_mutex_lock(&jobs->lock);
+    while (job->state != JOB_DONE) {
+        if (job->state == JOB_QUEUED &&
+            (jobs->nwriting == 0 || jobs->nbuffered < jobs->maxbuffered)) {
+            /* no need to buffer anything if this is next to be written */
+            unqueue(jobs, job);
+            job->state = JOB_RUNNING;
+            job->direct = jobs->nwriting == 0;
+            if (!job->direct) {
+                jobs->nbuffered++;
+            }
+            bool skip = jobs->stopped;
+            pthread_mutex_unlock(&jobs->lock);
+
+            if (skip) {
+                /* nothing to run */
+            } else if (job->direct) {
+                jobs->func(job, job->arg, stdout, jobs->context);
+            } else {
+                runbuffered(jobs, job);
+            }
+
+            pthread_mutex_lock(&jobs->lock);
+            finishjob(jobs, job);
+        } else {
+            /* for it to finish, or the writer to catch up */
+            pthread_cond_wait(&jobs->done, &jobs->lock);
+        }
+    }
+    bool stopped = jobs->stopped;
+    pthread_mutex_unlock(&jobs->lock);
+
+    if (!job->direct) {
+        handoff(jobs, job, !stopped);
+    }
+    /* if no one is reading, there's no point carrying on */
+    if (!stopped && (job->last || (job->direct && ferror(stdout)))) {
+        pthread_mutex_lock(&jobs->lock);
+        jobs->stopped = true;
+        pthread_mutex_unlock(&jobs->lock);
+    }
+
+    if (job->subjobs) {
+        int nsubjobs = length(job->subjobs);
+        for (int i = 0; i < nsubjobs; i++) {
+            outputjob(jobs, getitem(job->subjobs, i));
+        }
+    }
+    freejob(job);
+}
+
+void runjobs(Jobs *jobs)
+{
+    if (!jobs) {
+        errorf("jobs is NULL\n");
+        return;
+    }
+
+    int ntoplevel = length(jobs->toplevel);
+    if (ntoplevel == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&jobs->lock);
+    queuelist(jobs, jobs->toplevel);
+    pthread_mutex_unlock(&jobs->lock);
+
+    if (jobs->maxthreads > 0 && !jobs->threads) {
+        jobs->threads = malloc(jobs->maxthreads * sizeof(*jobs->threads));
+        for (int i = 0; jobs->threads && i < jobs->maxthreads; i++) {
+            if (pthread_create(&jobs->threads[i], NULL, worker, jobs) != 0) {
+                /* not fatal, make do with what we have */
+                errorf("Cannot start thread %d\n", i + 1);
+                break;
+            }
+            jobs->nthreads++;
+        }
+    }
+    if (jobs->nthreads > 0 && !jobs->haswriter) {
+        /* so writing one job's output doesn't hold up running the next */
+        jobs->haswriter = pthread_create(&jobs->writer, NULL, writer, jobs) == 0;
+    }
+
+    for (int i = 0; i < ntoplevel; i++) {
+        outputjob(jobs, getitem(jobs->toplevel, i));
+    }
+    /* so whatever the caller writes next comes after it */
+    pthread_mutex_lock(&jobs->lock);
+    while (jobs->nwriting > 0) {
+        pthread_cond_wait(&jobs->done, &jobs->lock);
+    }
+    pthread_mutex_unlock(&jobs->lock);
+    /* the jobs themselves have been freed */
+    freelist(jobs->toplevel, nofree);
+    jobs->toplevel = newlist();
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
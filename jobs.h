@@ -0,0 +1,119 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "list.h"
+
+/*
+ * Jobs that run in parallel but whose output comes out in a fixed order.
+ *
+ * Each job may add subjobs while it runs.  Output is in depth-first order:
+ * a job's output, then each of its subjobs' (and their subjobs') in the
+ * order they were added, then the job's next sibling.  That's the order
+ * the jobs would produce if they were simply run one after another, each
+ * running its subjobs as it finished, so the output is the same whatever
+ * the number of threads.
+ *
+ * Jobs running on other threads write to a buffer, and their error
+ * messages are captured, so both can be replayed in order.
+ * Jobs are preferably started in output order, and when the next job to
+ * output hasn't started yet, the output thread runs it itself, writing
+ * straight to stdout and stderr.
+ *
+ * With other threads, the buffers are written by a writer thread of their
+ * own, so while one job's output is written, the output thread can run
+ * the next job (buffered, until the writer has caught up), and the other
+ * threads the ones after that.
+ */
+
+typedef struct jobs Jobs;
+typedef struct job Job;
+
+/**
+ * Do the work for job.
+ *
+ * arg is what was passed to addjob() or addsubjob(),
+ * context is what was passed to newjobs().
+ * All output must go to out.
+ */
+typedef void (*job_func)(Job *job, void *arg, FILE *out, void *context);
+
+/**
+ * Create a set of jobs, all run with func, on up to nthreads threads
+ * (including the thread that calls runjobs()).
+ *
+ * Returns NULL on failure.
+ */
+Jobs *newjobs(int nthreads, job_func func, void *context);
+
+/**
+ * Stop any threads and free jobs.
+ */
+void freejobs(Jobs *jobs);
+
+/**
+ * Write separator between the outputs of jobs, or before the first job's
+ * if started is true, e.g. because something was written before runjobs().
+ *
+ * Only jobs that call beginoutput() count as having output.
+ * separator must stay valid until jobs is freed.
+ */
+void setseparator(Jobs *jobs, const char *separator, bool started);
+
+/**
+ * Let up to depth jobs run ahead of the output, their output buffered
+ * until it's written, which bounds the memory used.  Defaults to 8 per thread.
+ */
+void setqueuedepth(Jobs *jobs, int depth);
+
+/**
+ * Call from a job_func before it writes anything to out, if it's going to.
+ *
+ * Writes the separator, if any, when an earlier job has output something,
+ * which can't be known in advance when the job runs in parallel.
+ */
+void beginoutput(Job *job, FILE *out);
+
+/**
+ * Add a top-level job, to be run with arg.
+ *
+ * freearg (which may be NULL) is called on arg once the job
+ * and all its subjobs have been output.
+ */
+void addjob(Jobs *jobs, void *arg, free_func freearg);
+
+/**
+ * Add a job whose output follows parent's, and parent's earlier subjobs'.
+ *
+ * Must only be called from parent's job_func.
+ */
+void addsubjob(Job *parent, void *arg, free_func freearg);
+
+/**
+ * Don't run or output any jobs after job, e.g. because there's nothing
+ * more to output.  job's own output, and everything before it, still
+ * comes out.  Must only be called from job's job_func.
+ *
+ * runjobs() does the same itself after a job whose output couldn't be
+ * written to stdout, e.g. because the other end of a pipe went away.
+ */
+void stopjobs(Job *job);
+
+/**
+ * Return true if stopjobs() has been called, so a job_func
+ * can give up early, since its output will probably be thrown away.
+ */
+bool jobsstopped(Job *job);
+
+/**
+ * Run all the jobs and write their output to stdout,
+ * and their error messages to stderr, in order.
+ *
+ * Returns when all the jobs are done, or have been stopped.
+ */
+void runjobs(Jobs *jobs);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,185 @@
+#define _POSIX_C_SOURCE 200809L /* for nanosleep(), strdup() */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jobs.h"
+#include "logging.h"
+
+void test_output_is_depth_first(void);
+void test_errors_stay_in_place(void);
+void test_separator_only_between_outputs(void);
+void test_nothing_after_stop(void);
+void test_queue_depth(void);
+
+int main(int argc, const char *argv[])
+{
+    myname = "jobstest";
+
+    test_output_is_depth_first();
+    test_errors_stay_in_place();
+    test_separator_only_between_outputs();
+    test_nothing_after_stop();
+    test_queue_depth();
+    return 0;
+}
+
+enum testmode { PLAIN, WITH_ERRORS, WITH_SEPARATOR, WITH_STOP };
+
+/* for setqueuedepth(), 0 = the default */
+static int queuedepth = 0;
+
+/* each job is named by its path in the tree, e.g. "b12" */
+static void runjob(Job *job, void *arg, FILE *out, void *context)
+{
+    const char *name = arg;
+    enum testmode mode = *(enum testmode *)context;
+    size_t len = strlen(name);
+
+    /* finish in a different order to the output */
+    struct timespec delay = { 0, (name[len-1] % 3) * 1000000L };
+    nanosleep(&delay, NULL);
+
+    /* with a separator, jobs ending in 2 output nothing */
+    if (mode != WITH_SEPARATOR || name[len-1] != '2') {
+        beginoutput(job, out);
+        fprintf(out, "%s start\n", name);
+        if (mode == WITH_ERRORS && name[len-1] == '1') {
+            errorf("%s error\n", name);
+        }
+        fprintf(out, "%s end\n", name);
+    }
+    if (mode == WITH_STOP && strcmp(name, "a1") == 0) {
+        stopjobs(job);
+    }
+    if (len < 4) {
+        for (char c = '0'; c < '3'; c++) {
+            char *subname = malloc(len + 2);
+            assert(subname);
+            sprintf(subname, "%s%c", name, c);
+            addsubjob(job, subname, free);
+        }
+    }
+}
+
+/**
+ * Run jobs for top-level "a" and "b" on nthreads threads, in the given mode,
+ * with stdout and stderr both going to one file,
+ * and return what was written.
+ */
+static char *runall(int nthreads, enum testmode mode)
+{
+    FILE *capture = tmpfile();
+    assert(capture);
+    fflush(stdout);
+    fflush(stderr);
+    int oldout = dup(STDOUT_FILENO);
+    int olderr = dup(STDERR_FILENO);
+    dup2(fileno(capture), STDOUT_FILENO);
+    dup2(fileno(capture), STDERR_FILENO);
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    Jobs *jobs = newjobs(nthreads, runjob, &mode);
+    assert(jobs);
+    if (mode == WITH_SEPARATOR) {
+        setseparator(jobs, "--\n", false);
+    }
+    if (queuedepth != 0) {
+        setqueuedepth(jobs, queuedepth);
+    }
+    addjob(jobs, strdup("a"), free);
+    addjob(jobs, strdup("b"), free);
+    runjobs(jobs);
+    freejobs(jobs);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(oldout, STDOUT_FILENO);
+    dup2(olderr, STDERR_FILENO);
+    close(oldout);
+    close(olderr);
+
+    long size = ftell(capture);
+    assert(size > 0);
+    char *text = malloc(size + 1);
+    assert(text);
+    rewind(capture);
+    assert(fread(text, 1, size, capture) == size);
+    text[size] = '\0';
+    fclose(capture);
+    return text;
+}
+
+void test_output_is_depth_first(void)
+{
+    char *serial = runall(1, PLAIN);
+    /* a, a0, a00, a000, a001, a002, a01, ... */
+    const char *expected = "a start\na end\na0 start\na0 end\na00 start\na00 end\na000 start\n";
+    assert(strncmp(serial, expected, strlen(expected)) == 0);
+    char *parallel = runall(4, PLAIN);
+    assert(strcmp(serial, parallel) == 0);
+    free(serial);
+    free(parallel);
+}
+
+void test_errors_stay_in_place(void)
+{
+    char *serial = runall(1, WITH_ERRORS);
+    assert(strstr(serial, "a1 start\njobstest: runjob: a1 error\na1 end\n"));
+    char *parallel = runall(4, WITH_ERRORS);
+    assert(strcmp(serial, parallel) == 0);
+    free(serial);
+    free(parallel);
+}
+
+void test_separator_only_between_outputs(void)
+{
+    char *serial = runall(1, WITH_SEPARATOR);
+    /* a2 outputs nothing, so has no separator, nor does a first */
+    assert(strncmp(serial, "a start\na end\n--\na0 start\n", 26) == 0);
+    assert(strstr(serial, "a121 end\n--\na20 start\n"));
+    assert(!strstr(serial, "--\n--\n"));
+    char *parallel = runall(4, WITH_SEPARATOR);
+    assert(strcmp(serial, parallel) == 0);
+    free(serial);
+    free(parallel);
+}
+
+void test_nothing_after_stop(void)
+{
+    char *serial = runall(1, WITH_STOP);
+    /* a1's subjobs come after it, so they're stopped too */
+    const char *end = "a022 end\na1 start\na1 end\n";
+    size_t len = strlen(serial);
+    assert(len > strlen(end) && strcmp(serial + len - strlen(end), end) == 0);
+    char *parallel = runall(4, WITH_STOP);
+    assert(strcmp(serial, parallel) == 0);
+    free(serial);
+    free(parallel);
+}
+
+void test_queue_depth(void)
+{
+    char *serial = runall(1, WITH_ERRORS);
+    /* one job at a time ahead of the writer, and many */
+    int depths[] = { 1, 2, 1000 };
+    for (int i = 0; i < 3; i++) {
+        queuedepth = depths[i];
+        char *parallel = runall(4, WITH_ERRORS);
+        assert(strcmp(serial, parallel) == 0);
+        free(parallel);
+        parallel = runall(4, WITH_SEPARATOR);
+        char *expected = runall(1, WITH_SEPARATOR);
+        assert(strcmp(expected, parallel) == 0);
+        free(parallel);
+        free(expected);
+    }
+    queuedepth = 0;
+    free(serial);
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
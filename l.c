@@ -13,13 +13,15 @@
  *   which seems more correct to me, but this decision is not set in stone.
  */
 
-#define _XOPEN_SOURCE 600       /* for strdup(), snprintf() */
+#define _XOPEN_SOURCE 700       /* for strdup(), snprintf(), getdelim() */
+#define _DEFAULT_SOURCE         /* for DT_* on glibc */
 
 #include <sys/types.h>
 #include <sys/param.h>
 #include <assert.h>
-#include <dirent.h>
+#include <dirent.h>             /* for DT_* */
 #include <errno.h>
+#include <langinfo.h>
 #include <locale.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,33 +30,103 @@
 #include <unistd.h>
 
 #include "buf.h"
+#include "dir.h"
 #include "display.h"
 #include "field.h"
 #include "file.h"
 #include "filefields.h"
 #include "group.h"
+#include "jobs.h"
 #include "list.h"
 #include "logging.h"
 #include "map.h"
 #include "options.h"
+#include "pattern.h"
+#include "predicate.h"
+#include "prefetch.h"
+#include "sorter.h"
+#include "summary.h"
+#include "top.h"
 #include "user.h"
 
 typedef List FileList;              /* list of files */
 typedef List FileFieldList;         /* list of fields for each file */
 
+/* a directory to list, see listdirs() */
+typedef struct dirjob {
+    File *dir;                      /* not owned */
+    struct dirjob *parent;          /* the directory dir is in with -R, else NULL */
+    int depth;                      /* 0 for a directory given as an argument */
+    bool label;                     /* true = print "dir:" first */
+    bool opened;                    /* true = dir has been opened, and dev and ino are set */
+    dev_t dev;
+    ino_t ino;
+    /* kept until the subdirectories have been listed */
+    FileList *files;                /* the directory's subdirectories */
+    int dirfd;                      /* the directory, open, or -1 */
+} DirJob;
+
+/*
+ * A directory entry as sortdir() sorts it: this, then the name, then each
+ * field as a SortField and its string, each string with its NUL.
+ */
+typedef struct sortentry {
+    long long value;                /* see SortKey */
+    int missing;                    /* see SortKey */
+    int nfields;
+    size_t namelen;
+} SortEntry;
+
+typedef struct sortfield {
+    int align;                      /* enum align */
+    int width;
+    size_t len;
+} SortField;
+
+/*
+ * An entry kept by --top: enough to sort it, and its fields,
+ * without holding on to its File.
+ */
+typedef struct topentry {
+    SortKey key;                    /* key.name points into path */
+    char *path;                     /* NULL while it's only being offered */
+    File *file;                     /* while it's only being offered, else NULL */
+    FieldList *fields;
+} TopEntry;
+
+/* rough bytes held for each entry while a directory is read,
+ * its File, stat and name, for --max-memory */
+#define ENTRYCOST 512
+
+/* how far listing the arguments has got, across --files-from batches */
+typedef struct progress {
+    bool started;                   /* true = something has been listed */
+    bool indirs;                    /* true = the last thing listed was a directory's contents */
+} Progress;
+
 const int columnmargin = 1;
 
 int *getmaxfilefieldwidths(FileFieldList *filefields);
 void listfilewithnewline(File *file, Options *options);
-void listfiles(FileList *files, Options *options);
-void listdir(File *dir, Options *options);
+void listfiles(FileList *files, Options *options, FILE *out);
+void listdir(Job *job, DirJob *dirjob, Options *options, FILE *out);
 void listdirs(FileList *dirs, Options *options, bool firstoutput);
+void noop(void *ignored);
+bool limitreached(Options *options);
 void printtobuf(const char *text, enum escape escape, Buf *buf);
 int  printsize(File *file, Options *options);
-void printwithnewline(void *string);
+void printwithnewline(void *string, void *out);
 void sortfiles(List *files, Options *options);
 bool islinktodir(File *file);
 bool want(File *file, Options *options);
+void addarg(const char *path, FileList *args);
+void listargs(FileList *args, Options *options, Progress *progress);
+void listfilesfrom(const char *path, Options *options);
+int comparetopentries(const void *a, const void *b, void *context);
+void selectfiles(FileList *files, Options *options);
+void listbest(Options *options);
+void collectfiles(FileList *files, Options *options);
+void listsummary(Options *options);
 
 int main(int argc, char **argv)
 {
@@ -72,37 +144,104 @@ int main(int argc, char **argv)
     if (nargs == -1) {
         exit(2);
     }
+    if (options->top != 0 && options->recursive) {
+        /* one selection from the whole tree, printed at the end */
+        options->best = newtop(options->top, comparetopentries, options);
+        if (!options->best) {
+            error("Out of memory?\n");
+            exit(1);
+        }
+        options->fullpaths = true;
+    }
+    if (options->summarize != SUMMARIZE_NONE) {
+        /* totals of everything listed, printed at the end */
+        options->summary = newsummary(options->summarize);
+        if (!options->summary) {
+            error("Out of memory?\n");
+            exit(1);
+        }
+    }
 
     /* skip program name and flags */ 
     argc -= nargs, argv += nargs;
 
-    /* list current directory if no arguments were given */
-    if (argc == 0) {
-        argv[0] = ".";
-        argc = 1;
+    if (options->filesfrom) {
+        if (argc > 0) {
+            error("Cannot use --files-from with file arguments\n");
+            exit(2);
+        }
+        listfilesfrom(options->filesfrom, options);
+    } else {
+        /* list current directory if no arguments were given */
+        if (argc == 0) {
+            argv[0] = ".";
+            argc = 1;
+        }
+
+        List *args = newlist();
+        if (!args) {
+            error("Out of memory?\n");
+            exit(1);
+        }
+        for (int i = 0; i < argc; i++) {
+            addarg(argv[i], args);
+        }
+        Progress progress = { false, false };
+        listargs(args, options, &progress);
+    }
+    if (options->best) {
+        listbest(options);
+    }
+    if (options->summary) {
+        listsummary(options);
     }
+    freeoptions(options);
 
-    /*
-     * ls handles command lines differently depending on
-     * whether they are directories or regular files.
-     * regular files are listed first, then all directories follow
-     */
-    List *files = newlist();
-    if (!files) {
-        error("Out of memory?\n");
+    /* e.g. the other end of a pipe went away, with SIGPIPE ignored */
+    if (fflush(stdout) != 0 || ferror(stdout)) {
+        error("Cannot write output: %s\n", strerror(errno));
+        exit(2);
+    }
+}
+
+/*
+ * ls handles command lines differently depending on
+ * whether they are directories or regular files.
+ * regular files are listed first, then all directories follow
+ */
+
+/**
+ * Add path, from the command line or --files-from, to args.
+ */
+void addarg(const char *path, FileList *args)
+{
+    File *file = newfile("", path);
+    if (!file) {
+        error("Error creating file for %s\n", path);
         exit(1);
     }
-    List *dirs = newlist();
-    if (!dirs) {
+    append(file, args);
+}
+
+/**
+ * List args, and free them, as the arguments on one command line:
+ * the files first, then the contents of the directories.
+ *
+ * They're all stat'ed together first, so on a network file system
+ * they don't wait for each other, but errors still come out in order.
+ */
+void listargs(FileList *args, Options *options, Progress *progress)
+{
+    FileList *files = newlist();
+    FileList *dirs = newlist();
+    if (!files || !dirs) {
         error("Out of memory?\n");
         exit(1);
     }
-    for (int i = 0; i < argc; i++) {
-        File *file = newfile("", argv[i]);
-        if (!file) {
-            error("Error creating file for %s\n", argv[i]);
-            exit(1);
-        }
+    prefetchfiles(args, options, PREFETCH_ARGS);
+    int nargs = length(args);
+    for (int i = 0; i < nargs; i++) {
+        File *file = getitem(args, i);
         if (isstat(file)) {
             if (!options->directory &&
                 (isdir(file) ||
@@ -115,16 +254,87 @@ int main(int argc, char **argv)
             freefile(file);
         }
     }
+    freelist(args, (free_func)noop);
 
     int nfiles = length(files);
-    listfiles(files, options);
+    int ndirs = length(dirs);
+    if (limitreached(options) || ferror(stdout)) {
+        nfiles = ndirs = 0;
+    }
+    if (nfiles > 0 && (options->best || options->summary)) {
+        collectfiles(files, options);
+    } else if (nfiles > 0) {
+        /* as between the files and directories of one command line */
+        if (progress->indirs) {
+            putchar('\n');
+        }
+        listfiles(files, options, stdout);
+        progress->started = true;
+        progress->indirs = false;
+    }
     freelist(files, (free_func)freefile);
 
-    bool firstoutput = nfiles == 0;
-    listdirs(dirs, options, firstoutput);
+    if (ndirs > 0 && !limitreached(options) && !ferror(stdout)) {
+        listdirs(dirs, options, !progress->started);
+        progress->started = true;
+        progress->indirs = true;
+    }
     freelist(dirs, (free_func)freefile);
+}
 
-    freeoptions(options);
+/**
+ * List the paths in the file at path, or stdin if it's "-",
+ * as if they'd been given as arguments.
+ *
+ * They're read and listed --lookahead at a time, like xargs, so memory use
+ * doesn't grow with the number of paths, and output starts before the end.
+ */
+void listfilesfrom(const char *path, Options *options)
+{
+    bool isstdin = strcmp(path, "-") == 0;
+    FILE *in = isstdin ? stdin : fopen(path, "r");
+    if (!in) {
+        error("Cannot read %s: %s\n", path, strerror(errno));
+        exit(2);
+    }
+    int delim = options->nullpaths ? '\0' : '\n';
+    FileList *args = newlist();
+    if (!args) {
+        error("Out of memory?\n");
+        exit(1);
+    }
+    Progress progress = { false, false };
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    while ((len = getdelim(&line, &size, delim, in)) != -1) {
+        if (len > 0 && line[len-1] == delim) {
+            line[--len] = '\0';
+        }
+        if (len == 0) {
+            continue;
+        }
+        addarg(line, args);
+        if (options->lookahead != 0 && length(args) >= options->lookahead) {
+            listargs(args, options, &progress);
+            args = newlist();
+            if (!args) {
+                error("Out of memory?\n");
+                exit(1);
+            }
+        }
+        if (limitreached(options) || ferror(stdout)) {
+            break;
+        }
+    }
+    if (ferror(in)) {
+        error("Cannot read %s: %s\n", isstdin ? "stdin" : path, strerror(errno));
+    }
+    listargs(args, options, &progress);
+    free(line);
+    if (!isstdin) {
+        fclose(in);
+    }
 }
 
 StringList *makefilestrings(FileFieldList *filefields, int *fieldwidths)
@@ -260,12 +470,302 @@ void freefields(List *list)
 }
 
 /**
- * Print the given file list using the specified options.
+ * Return true if --limit entries have been listed already.
+ */
+bool limitreached(Options *options)
+{
+    return options->limit != 0 && options->listed >= options->limit;
+}
+
+/**
+ * Return the first of files that --limit still allows, and count them
+ * as listed: files itself if that's all of them, else a new list
+ * that doesn't own them.
+ */
+static FileList *limitfiles(FileList *files, Options *options)
+{
+    size_t nfiles = length(files);
+    if (options->limit == 0) {
+        return files;
+    }
+    size_t left = limitreached(options) ? 0 : options->limit - options->listed;
+    if (nfiles <= left) {
+        options->listed += nfiles;
+        return files;
+    }
+    FileList *first = newlist();
+    if (first == NULL) {
+        errorf("first is NULL\n");
+        return files;
+    }
+    for (size_t i = 0; i < left; i++) {
+        append(getitem(files, i), first);
+    }
+    options->listed = options->limit;
+    return first;
+}
+
+static void displayfilefields(FileFieldList *filefields, Options *options, FILE *out);
+static void printfilefields(FileFieldList *filefields, int *fieldwidths, FILE *out);
+
+/**
+ * Compare two Files for --top, in the order they're listed in.
+ */
+static int comparetopfiles(const void *a, const void *b, void *context)
+{
+    Options *options = context;
+    int result = options->compare((const File **)&a, (const File **)&b);
+    return options->reverse ? -result : result;
+}
+
+/**
+ * Return the first --top of files, in the order they're listed in,
+ * in a new list that doesn't own them, or files itself on failure.
+ *
+ * Only the ones kept are ever in order, so this is quicker than sorting
+ * all of them.
+ */
+static FileList *topfiles(FileList *files, Options *options)
+{
+    Top *top = newtop(options->top, comparetopfiles, options);
+    if (top == NULL) {
+        errorf("top is NULL\n");
+        sortfiles(files, options);
+        return files;
+    }
+    int nfiles = length(files);
+    for (int i = 0; i < nfiles; i++) {
+        addtop(top, getitem(files, i));
+    }
+    FileList *first = taketop(top);
+    freetop(top, (free_func)noop);
+    return first ? first : files;
+}
+
+/**
+ * Compare two TopEntry items, in the order they're listed in.
+ *
+ * Files with the same name in different directories go by their paths.
+ */
+int comparetopentries(const void *a, const void *b, void *context)
+{
+    Options *options = context;
+    const TopEntry *ea = a, *eb = b;
+    int result = comparesortkeys(&ea->key, &eb->key, options->compare);
+    if (result == 0) {
+        result = strcoll(ea->path ? ea->path : getpath(ea->file),
+                         eb->path ? eb->path : getpath(eb->file));
+    }
+    return options->reverse ? -result : result;
+}
+
+static void freetopentry(TopEntry *entry)
+{
+    if (!entry) return;
+    free(entry->path);
+    freefields(entry->fields);
+    free(entry);
+}
+
+/**
+ * Offer each of files to top, formatting only the ones it keeps, for now.
+ */
+static void offerfiles(FileList *files, Top *top, Options *options)
+{
+    int nfiles = length(files);
+    for (int i = 0; i < nfiles; i++) {
+        File *file = getitem(files, i);
+        TopEntry offer = { .file = file };
+        getsortkey(file, options->compare, &offer.key);
+        if (!wouldkeep(top, &offer)) {
+            continue;
+        }
+        TopEntry *entry = malloc(sizeof(*entry));
+        char *path = strdup(getpath(file));
+        FieldList *fields = getfilefields(file, options);
+        if (entry == NULL || path == NULL || fields == NULL) {
+            errorf("Out of memory\n");
+            free(entry);
+            free(path);
+            freefields(fields);
+            continue;
+        }
+        entry->key = offer.key;
+        entry->key.name = path + strlen(path) - strlen(getname(file));
+        entry->path = path;
+        entry->file = NULL;
+        entry->fields = fields;
+        freetopentry(addtop(top, entry));
+    }
+}
+
+/**
+ * Offer each of files to options->best, the --top of the whole tree.
+ */
+void selectfiles(FileList *files, Options *options)
+{
+    offerfiles(files, options->best, options);
+}
+
+/**
+ * Print what's in top to out, in order, and free it.
+ */
+static void listtop(Top *top, Options *options, FILE *out)
+{
+    List *entries = taketop(top);
+    freetop(top, (free_func)freetopentry);
+    FileFieldList *filefields = newlist();
+    if (entries == NULL || filefields == NULL) {
+        errorf("entries or filefields is NULL\n");
+        freelist(entries, (free_func)freetopentry);
+        freelist(filefields, (free_func)noop);
+        return;
+    }
+    size_t nentries = length(entries);
+    for (size_t i = 0; i < nentries && !limitreached(options); i++) {
+        TopEntry *entry = getitem(entries, i);
+        append(entry->fields, filefields);
+        entry->fields = NULL;
+        if (options->limit != 0) {
+            options->listed++;
+        }
+    }
+    freelist(entries, (free_func)freetopentry);
+    displayfilefields(filefields, options, out);
+}
+
+/**
+ * Print what's in options->best, the --top of the whole tree, and free it.
+ */
+void listbest(Options *options)
+{
+    listtop(options->best, options, stdout);
+    options->best = NULL;
+}
+
+/**
+ * Set files aside for what's printed once everything has been listed:
+ * the --top of the whole tree, or the --summarize-by or --count totals.
+ */
+void collectfiles(FileList *files, Options *options)
+{
+    if (!options->summary) {
+        selectfiles(files, options);
+        return;
+    }
+    int nfiles = length(files);
+    for (int i = 0; i < nfiles; i++) {
+        addtosummary(options->summary, getitem(files, i), options->blocksize);
+    }
+}
+
+/**
+ * Return the fields of a --summarize-by line: group's entries, bytes,
+ * and blocks, then key.
+ */
+static FieldList *getgroupfields(SummaryGroup *group, const char *key, Options *options)
+{
+    FieldList *fields = newlist();
+    Buf *buf = newbuf();
+    if (fields == NULL || buf == NULL) {
+        errorf("fields or buf is NULL\n");
+        freelist(fields, (free_func)noop);
+        freebuf(buf);
+        return NULL;
+    }
+    char numbers[3][32];
+    snprintf(numbers[0], sizeof(numbers[0]), "%lu", group->count);
+    snprintf(numbers[1], sizeof(numbers[1]), "%llu", group->bytes);
+    snprintf(numbers[2], sizeof(numbers[2]), "%llu", group->blocks);
+    if (options->sizestyle == SIZE_HUMAN) {
+        /* as -h shows -B and -s */
+        char *bytes = humanbytes(group->bytes);
+        char *blocks = humanbytes(group->blocks * options->blocksize);
+        if (bytes && blocks) {
+            snprintf(numbers[1], sizeof(numbers[1]), "%s", bytes);
+            snprintf(numbers[2], sizeof(numbers[2]), "%s", blocks);
+        }
+        free(bytes);
+        free(blocks);
+    }
+    for (int i = 0; i < 3; i++) {
+        append(newfield(numbers[i], ALIGN_RIGHT, strlen(numbers[i])), fields);
+    }
+    printtobuf(key, options->escape, buf);
+    append(newfield(bufstring(buf), ALIGN_NONE, bufscreenpos(buf)), fields);
+    freebuf(buf);
+    return fields;
+}
+
+/**
+ * Print options->summary, the totals for --summarize-by or --count, and free it.
+ *
+ * --count is just the number of entries.  Otherwise, like wc, each group
+ * is a line of its entries, bytes and blocks, then what it's for,
+ * and the last line is the total.
+ */
+void listsummary(Options *options)
+{
+    Summary *summary = options->summary;
+    options->summary = NULL;
+    List *groups = getsummarygroups(summary);
+    FileFieldList *filefields = newlist();
+    if (groups == NULL || filefields == NULL) {
+        errorf("groups or filefields is NULL\n");
+        freelist(groups, (free_func)noop);
+        freelist(filefields, (free_func)noop);
+        freesummary(summary);
+        return;
+    }
+    SummaryGroup total = { .known = true };
+    int ngroups = length(groups);
+    for (int i = 0; i < ngroups; i++) {
+        SummaryGroup *group = getitem(groups, i);
+        total.count += group->count;
+        total.bytes += group->bytes;
+        total.blocks += group->blocks;
+        if (options->summarize == SUMMARIZE_COUNT) {
+            continue;
+        }
+        /* owners and groups by name, as with -o and -g */
+        char *key;
+        if (group->known && options->summarize == SUMMARIZE_OWNER) {
+            key = lookupusername(group->key, options);
+        } else if (group->known && options->summarize == SUMMARIZE_GROUP) {
+            key = lookupgroupname(group->key, options);
+        } else {
+            key = getsummarykey(summary, group);
+        }
+        FieldList *fields = key ? getgroupfields(group, key, options) : NULL;
+        if (fields) {
+            append(fields, filefields);
+        }
+        free(key);
+    }
+    freelist(groups, (free_func)noop);
+    freesummary(summary);
+
+    if (options->summarize == SUMMARIZE_COUNT) {
+        printf("%lu\n", total.count);
+        freelist(filefields, (free_func)noop);
+        return;
+    }
+    FieldList *fields = getgroupfields(&total, "total", options);
+    if (fields) {
+        append(fields, filefields);
+    }
+    int *fieldwidths = getmaxfilefieldwidths(filefields);
+    printfilefields(filefields, fieldwidths, stdout);
+    free(fieldwidths);
+}
+
+/**
+ * Print the given file list to out using the specified options.
  *
  * This function does any required sorting and figures out
  * what display format to use for printing.
  */
-void listfiles(FileList *files, Options *options)
+void listfiles(FileList *files, Options *options, FILE *out)
 {
     if (files == NULL) {
         errorf("files is NULL\n");
@@ -282,8 +782,14 @@ void listfiles(FileList *files, Options *options)
 
     /*
      * sort files according to user preference...
+     * (or with --top, just pick out the first few, in order)
      */
-    sortfiles(files, options);
+    FileList *sorted = files;
+    if (options->top != 0) {
+        sorted = topfiles(files, options);
+    } else {
+        sortfiles(files, options);
+    }
 
     /*
      * ...reverse the list if -r flag was given...
@@ -292,19 +798,44 @@ void listfiles(FileList *files, Options *options)
      *  it could also be done in sortfiles(), but I can't
      *  think of a clean way to do that at the moment)
      */
-    if (options->reverse) {
+    if (options->reverse && sorted == files) {
         reverselist(files);
     }
 
+    /*
+     * ...leave out any past --limit...
+     */
+    FileList *shown = limitfiles(sorted, options);
+
     /*
      * ...construct the fields to output for each file...
      */
-    FileFieldList *filefields = map(files, (map_func)getfilefields, options);
-    int *fieldwidths = getmaxfilefieldwidths(filefields);
+    FileFieldList *filefields = map(shown, (map_func)getfilefields, options);
+    if (shown != sorted) {
+        freelist(shown, (free_func)noop);
+    }
+    if (sorted != files) {
+        freelist(sorted, (free_func)noop);
+    }
     /* we don't own files, so don't free it here */
 
+    displayfilefields(filefields, options, out);
+}
+
+/**
+ * Print filefields, the fields of each file to list, to out
+ * in the display format, and free them.
+ */
+static void displayfilefields(FileFieldList *filefields, Options *options, FILE *out)
+{
+    if (length(filefields) == 0) {
+        freelist(filefields, (free_func)freefields);
+        return;
+    }
+    int *fieldwidths = getmaxfilefieldwidths(filefields);
+
     /*
-     * ...make the output for each file into a single string...
+     * make the output for each file into a single string...
      * (each string being of the same length for use in a columns/rows)
      */
     StringList *filestrings = makefilestrings(filefields, fieldwidths);
@@ -314,18 +845,18 @@ void listfiles(FileList *files, Options *options)
     freelist(filefields, (free_func)freefields);
 
     /*
-     * ...and finally print the output
+     * ...and print the output
      */
     switch (options->displaymode) {
     case DISPLAY_ONE_PER_LINE:
-        walklist(filestrings, printwithnewline);
-        /*printdown(filestrings, 0, 0);*/
+        walklistcontext(filestrings, printwithnewline, out);
+        /*printdown(out, filestrings, 0, 0);*/
         break;
     case DISPLAY_IN_COLUMNS:
-        printdown(filestrings, filewidth, options->screenwidth);
+        printdown(out, filestrings, filewidth, options->screenwidth);
         break;
     case DISPLAY_IN_ROWS:
-        printacross(filestrings, filewidth, options->screenwidth);
+        printacross(out, filestrings, filewidth, options->screenwidth);
         break;
     }
 
@@ -335,90 +866,965 @@ void listfiles(FileList *files, Options *options)
 void noop(void *ignored)
 {}
 
+static DirJob *newdirjob(File *dir, DirJob *parent, bool label)
+{
+    DirJob *dirjob = malloc(sizeof(*dirjob));
+    if (!dirjob) {
+        errorf("Out of memory\n");
+        return NULL;
+    }
+    dirjob->dir = dir;
+    dirjob->parent = parent;
+    dirjob->depth = parent ? parent->depth + 1 : 0;
+    dirjob->label = label;
+    dirjob->opened = false;
+    dirjob->files = NULL;
+    dirjob->dirfd = -1;
+    return dirjob;
+}
+
 /**
- * Print the contents of the given directory.
+ * Free dirjob, once its subdirectories have been listed.
  */
-void listdir(File *dir, Options *options)
+static void freedirjob(DirJob *dirjob)
 {
-    List *files = newlist();
-    if (files == NULL) {
-        errorf("files in NULL\n");
-        return;
-    }
-    DIR *openeddir = opendir(getpath(dir));
-    if (openeddir == NULL) {
-        errorf("Cannot open %s\n", getpath(dir));
-        freelist(files, (free_func)freefile);
-        return;
+    if (!dirjob) return;
+    freelist(dirjob->files, (free_func)freefile);
+    /* only now that nothing refers to it */
+    if (dirjob->dirfd != -1) {
+        close(dirjob->dirfd);
     }
-    unsigned long totalblocks = 0;
-    List *subdirs = newlist();
-    if (subdirs == NULL) {
-        errorf("subdirs is NULL\n");
-        closedir(openeddir);
-        freelist(files, (free_func)freefile);
-        return;
-    }
-    struct dirent *dirent = NULL;
-    while ((dirent = readdir(openeddir)) != NULL) {
+    free(dirjob);
+}
+
+/**
+ * Read entries from reader into files, until there are none left,
+ * or files has max entries (if max isn't 0).
+ *
+ * Returns true if it stopped because files was full, otherwise sets
+ * *readerror to 0 at the end of the directory, or an errno value.
+ */
+static bool readentries(DirReader *reader, int dirfd, File *dir, Options *options,
+                        FileList *files, size_t max, int *readerror)
+{
+    const DirEntry *entry = NULL;
+    while ((max == 0 || length(files) < max) &&
+           (entry = readdirentry(reader)) != NULL) {
+        /* check the name in the reader's buffer before allocating anything */
         /* TODO: merge this hidden file check with want() */
-        if (!options->all && dirent->d_name[0] == '.') {
+        if (!options->all && entry->name[0] == '.') {
+            continue;
+        }
+        if (options->ignore && matchpatterns(options->ignore, entry->name)) {
+            continue;
+        }
+        /* --include doesn't apply to directories, so -R can go into them */
+        bool included = !options->include || entry->type == DT_DIR ||
+                        matchpatterns(options->include, entry->name);
+        if (!included && entry->type != DT_UNKNOWN) {
             continue;
         }
-        File *file = newfile(getpath(dir), dirent->d_name);
+        /* --where is tried on what readdir() told us first, but a directory
+         * that doesn't match is still kept for -R to go into */
+        enum match match = MATCH_YES;
+        if (options->where) {
+            match = matchentry(options->where, entry->name, entry->type, entry->inode);
+            bool maybedir = entry->type == DT_DIR || entry->type == DT_UNKNOWN ||
+                            (entry->type == DT_LNK && options->targetinfo);
+            if (match == MATCH_NO && !(options->recursive && maybedir)) {
+                continue;
+            }
+        }
+        File *file = newfilein(dirfd, dir, entry->name);
         if (file == NULL) {
             errorf("file is NULL\n");
-            break;
+            *readerror = 0;
+            return false;
         }
-        if (!want(file, options)) {
+        /* lets -D, -R, -F, -i, etc. avoid stat'ing the file */
+        setdirentinfo(file, entry->inode, entry->type);
+        if (!want(file, options) || (!included && !isdir(file)) ||
+                (match == MATCH_NO && !isdir(file))) {
             freefile(file);
             continue;
         }
         append(file, files);
-        if (options->recursive && isdir(file)) {
-            append(file, subdirs);
-        }
-        if (options->dirtotals) {
-            totalblocks += getblocks(file, options->blocksize);
-        }
-    }
-    closedir(openeddir);
-
-    if (options->dirtotals) {
-        printf("total %lu\n", totalblocks);
     }
-    listfiles(files, options);
-    if (options->recursive) {
-        listdirs(subdirs, options, false);
+    if (entry == NULL && (max == 0 || length(files) < max)) {
+        *readerror = errno;
+        return false;
     }
-    freelist(files, (free_func)freefile);
-    // subdirs doesn't own the files (those are freed by freelist(files)),
-    // but we should free the subdirs list itself
-    freelist(subdirs, (free_func)noop);
+    return true;
 }
 
-void listdirs(FileList *dirs, Options *options, bool firstoutput)
+/**
+ * Return true if file is a directory's "." or ".." entry.
+ */
+static bool isdots(File *file)
 {
-    if (!dirs) return;
-    int ndirs = length(dirs);
-    bool needlabel = ndirs > 1 || !firstoutput || options->recursive;
-    for (int i = 0; i < ndirs; i++) {
-        File *dir = getitem(dirs, i);
-        if (!dir) {
-            error("dir is NULL\n");
-            continue;
-        }
-        if (i > 0) {
-            firstoutput = false;
-        }
-        if (!firstoutput) {
-            printf("\n");
-        }
-        if (needlabel) {
-            printf("%s:\n", getpath(dir));
+    const char *name = getname(file);
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+/**
+ * Return true if file, in the directory in dirjob, should be listed with -R.
+ */
+static bool wantsubdir(File *file, DirJob *dirjob, Options *options)
+{
+    if (!options->recursive) {
+        return false;
+    }
+    /* like ls, never "." or "..", which with -a would go round or up */
+    if (isdots(file)) {
+        return false;
+    }
+    /* checked first, so at the limit nothing has to be stat'ed */
+    if (options->maxdepth >= 0 && dirjob->depth >= options->maxdepth) {
+        return false;
+    }
+    if (!isdir(file)) {
+        return false;
+    }
+    /* dirjob's device is the same as the top directory's,
+     * since no other device is gone into */
+    if (options->onefilesystem && dirjob->opened && getdev(file) != dirjob->dev) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Move the directories in files that should be listed with -R to subdirs,
+ * and free files and everything else in it.
+ */
+static void keepsubdirs(FileList *files, FileList *subdirs, DirJob *dirjob, Options *options)
+{
+    int nfiles = length(files);
+    for (int i = 0; i < nfiles; i++) {
+        File *file = getitem(files, i);
+        if (wantsubdir(file, dirjob, options)) {
+            append(file, subdirs);
+        } else {
+            freefile(file);
         }
-        listdir(dir, options);
     }
+    freelist(files, (free_func)noop);
+}
+
+/**
+ * Return the files in files that match --where, in a new list that doesn't
+ * own them, or files itself if there's no --where.
+ *
+ * Only what the expression needs is stat'ed, which prefetchfiles()
+ * has usually done already.
+ */
+static FileList *filterfiles(FileList *files, Options *options)
+{
+    if (!options->where) {
+        return files;
+    }
+    FileList *listed = newlist();
+    if (listed == NULL) {
+        errorf("listed is NULL\n");
+        return files;
+    }
+    int nfiles = length(files);
+    for (int i = 0; i < nfiles; i++) {
+        File *file = getitem(files, i);
+        if (matchfile(options->where, file, options->now)) {
+            append(file, listed);
+        }
+    }
+    return listed;
+}
+
+/**
+ * Widen *fieldwidths, the widths used so far (NULL at first),
+ * to fit filefields, which mustn't be empty.
+ *
+ * Returns false if that couldn't be done.
+ */
+static bool widenfields(int **fieldwidths, FileFieldList *filefields)
+{
+    int *widths = getmaxfilefieldwidths(filefields);
+    if (!widths) {
+        return false;
+    }
+    if (*fieldwidths) {
+        int nfields = length(getitem(filefields, 0));
+        for (int i = 0; i < nfields; i++) {
+            if ((*fieldwidths)[i] > widths[i]) {
+                widths[i] = (*fieldwidths)[i];
+            }
+        }
+        free(*fieldwidths);
+    }
+    *fieldwidths = widths;
+    return true;
+}
+
+/**
+ * Print files, one per line, as part of a longer unsorted listing.
+ *
+ * *fieldwidths holds the widths used so far (NULL at first), and only
+ * ever grows, so columns stay aligned unless a later entry is wider.
+ */
+static void listbatch(FileList *files, Options *options, int **fieldwidths, FILE *out)
+{
+    FileList *shown = limitfiles(files, options);
+    FileFieldList *filefields = map(shown, (map_func)getfilefields, options);
+    if (shown != files) {
+        freelist(shown, (free_func)noop);
+    }
+    if (length(filefields) == 0) {
+        freelist(filefields, (free_func)freefields);
+        return;
+    }
+    if (!widenfields(fieldwidths, filefields)) {
+        freelist(filefields, (free_func)freefields);
+        return;
+    }
+
+    StringList *filestrings = makefilestrings(filefields, *fieldwidths);
+    freelist(filefields, (free_func)freefields);
+    walklistcontext(filestrings, printwithnewline, out);
+    freelist(filestrings, (free_func)free);
+}
+
+/**
+ * Return true if dirjob's directory is deep enough to be listed,
+ * rather than just gone through to reach its subdirectories.
+ */
+static bool showdir(DirJob *dirjob, Options *options)
+{
+    return dirjob->depth >= options->mindepth;
+}
+
+/**
+ * Return what the entries of dirjob's directory need prefetching for.
+ */
+static unsigned int prefetchpurpose(DirJob *dirjob, Options *options)
+{
+    unsigned int purpose = 0;
+    if (showdir(dirjob, options)) {
+        purpose |= PREFETCH_LIST;
+    }
+    if (options->recursive &&
+            (options->maxdepth < 0 || dirjob->depth < options->maxdepth)) {
+        purpose |= PREFETCH_RECURSE;
+    }
+    return purpose;
+}
+
+/**
+ * Return how many entries to read before printing them, when unsorted
+ * one-per-line output is streamed: --lookahead, or just what --limit
+ * still allows if that's fewer.
+ */
+static size_t getbatchsize(Options *options)
+{
+    size_t max = options->lookahead;
+    if (max != 0 && options->limit != 0 && !limitreached(options) &&
+            options->limit - options->listed < max) {
+        max = options->limit - options->listed;
+    }
+    return max;
+}
+
+/**
+ * Print the rest of an unsorted one-per-line listing, whose first
+ * batch of entries is in files, a batch at a time,
+ * freeing each batch once it's printed.
+ *
+ * With -s or -l, the total is printed at the end.
+ * With --top and -R, or a summary, the entries are collected instead.
+ * Without -R, --top's entries are kept in top, and printed at the end,
+ * after the total.
+ * Above --min-depth nothing is printed, and only the subdirectories are kept.
+ * Stops reading once --limit is reached, or out can't be written to.
+ * Returns the subdirectories to list with -R.
+ */
+static FileList *streamdir(Job *job, DirReader *reader, int dirfd, DirJob *dirjob,
+                           Options *options, FileList *files, Top *top, FILE *out)
+{
+    bool show = showdir(dirjob, options);
+    bool collecting = options->best || options->summary;
+    unsigned int purpose = prefetchpurpose(dirjob, options);
+    File *dir = dirjob->dir;
+    FileList *subdirs = newlist();
+    if (subdirs == NULL) {
+        errorf("subdirs is NULL\n");
+        freelist(files, (free_func)freefile);
+        return NULL;
+    }
+    unsigned long totalblocks = 0;
+    int *fieldwidths = NULL;
+    int readerror = 0;
+    bool more = true;
+    while (files) {
+        prefetchfiles(files, options, purpose);
+        if (show && collecting) {
+            FileList *listed = filterfiles(files, options);
+            collectfiles(listed, options);
+            if (listed != files) {
+                freelist(listed, (free_func)noop);
+            }
+        } else if (show) {
+            FileList *listed = filterfiles(files, options);
+            int nlisted = length(listed);
+            for (int i = 0; i < nlisted; i++) {
+                if (options->dirtotals) {
+                    totalblocks += getblocks(getitem(listed, i), options->blocksize);
+                }
+            }
+            if (top) {
+                offerfiles(listed, top, options);
+            } else if (nlisted > 0) {
+                listbatch(listed, options, &fieldwidths, out);
+            }
+            if (listed != files) {
+                freelist(listed, (free_func)noop);
+            }
+        }
+        keepsubdirs(files, subdirs, dirjob, options);
+        files = NULL;
+        /* e.g. after head has all it wants */
+        if (limitreached(options) || ferror(out) || jobsstopped(job)) {
+            more = false;
+        }
+        if (more) {
+            files = newlist();
+            if (files == NULL) {
+                errorf("files is NULL\n");
+                break;
+            }
+            more = readentries(reader, dirfd, dir, options, files, getbatchsize(options),
+                               &readerror);
+        }
+    }
+    free(fieldwidths);
+    if (readerror != 0) {
+        errorf("Cannot read %s: %s\n", getpath(dir), strerror(readerror));
+    }
+    if (show && options->dirtotals && !collecting) {
+        fprintf(out, "total %lu\n", totalblocks);
+    }
+    if (top) {
+        listtop(top, options, out);
+    }
+    return subdirs;
+}
+
+/**
+ * Return how many entries to read at a time with --max-memory,
+ * for a directory that's more than that.
+ */
+static size_t getsortbatchsize(Options *options)
+{
+    size_t max = options->maxmemory / 2 / ENTRYCOST;
+    return max > 0 ? max : 1;
+}
+
+/**
+ * Add file, and its fields, to sorter as a SortEntry.
+ */
+static bool addsortentry(Sorter *sorter, File *file, FieldList *fields, Options *options)
+{
+    SortKey key;
+    getsortkey(file, options->compare, &key);
+    SortEntry entry = { key.value, key.missing, length(fields), strlen(key.name) };
+    size_t size = sizeof(entry) + entry.namelen + 1;
+    for (int i = 0; i < entry.nfields; i++) {
+        size += sizeof(SortField) + strlen(fieldstring(getitem(fields, i))) + 1;
+    }
+    char *record = malloc(size);
+    if (record == NULL) {
+        errorf("Out of memory\n");
+        return false;
+    }
+    char *p = record;
+    memcpy(p, &entry, sizeof(entry));
+    p += sizeof(entry);
+    memcpy(p, key.name, entry.namelen + 1);
+    p += entry.namelen + 1;
+    for (int i = 0; i < entry.nfields; i++) {
+        Field *field = getitem(fields, i);
+        const char *string = fieldstring(field);
+        SortField sortfield = { fieldalign(field), fieldwidth(field), strlen(string) };
+        memcpy(p, &sortfield, sizeof(sortfield));
+        p += sizeof(sortfield);
+        memcpy(p, string, sortfield.len + 1);
+        p += sortfield.len + 1;
+    }
+    bool ok = addrecord(sorter, record, size);
+    free(record);
+    return ok;
+}
+
+/**
+ * Compare two SortEntry records, in the order listfiles() would list them.
+ */
+static int comparesortentries(const void *a, const void *b, void *context)
+{
+    Options *options = context;
+    SortEntry ea, eb;
+    memcpy(&ea, a, sizeof(ea));
+    memcpy(&eb, b, sizeof(eb));
+    SortKey ka = { (const char *)a + sizeof(ea), ea.value, ea.missing };
+    SortKey kb = { (const char *)b + sizeof(eb), eb.value, eb.missing };
+    int result = comparesortkeys(&ka, &kb, options->compare);
+    return options->reverse ? -result : result;
+}
+
+/**
+ * Return the fields in a SortEntry record.
+ */
+static FieldList *getsortfields(const char *record)
+{
+    FieldList *fields = newlist();
+    if (fields == NULL) {
+        errorf("fields is NULL\n");
+        return NULL;
+    }
+    SortEntry entry;
+    memcpy(&entry, record, sizeof(entry));
+    const char *p = record + sizeof(entry) + entry.namelen + 1;
+    for (int i = 0; i < entry.nfields; i++) {
+        SortField sortfield;
+        memcpy(&sortfield, p, sizeof(sortfield));
+        p += sizeof(sortfield);
+        Field *field = newfield(p, sortfield.align, sortfield.width);
+        if (field) {
+            append(field, fields);
+        }
+        p += sortfield.len + 1;
+    }
+    return fields;
+}
+
+/**
+ * Print filefields, one per line, padded to fieldwidths, and free them.
+ */
+static void printfilefields(FileFieldList *filefields, int *fieldwidths, FILE *out)
+{
+    StringList *filestrings = makefilestrings(filefields, fieldwidths);
+    freelist(filefields, (free_func)freefields);
+    walklistcontext(filestrings, printwithnewline, out);
+    freelist(filestrings, (free_func)free);
+}
+
+/**
+ * Print sorter's entries in order, one per line, padded to fieldwidths,
+ * until --limit is reached or out can't be written to.
+ *
+ * With --limit, the columns are only as wide as what's shown, as with
+ * listfiles(), so those entries are all read back before printing them.
+ */
+static void printsorted(Job *job, Sorter *sorter, int *fieldwidths, Options *options,
+                        FILE *out)
+{
+    bool limited = options->limit != 0;
+    FileFieldList *filefields = newlist();
+    const char *record;
+    size_t size;
+    while (filefields && !limitreached(options) && !ferror(out) && !jobsstopped(job) &&
+           (record = nextrecord(sorter, &size)) != NULL) {
+        FieldList *fields = getsortfields(record);
+        if (fields == NULL) {
+            break;
+        }
+        append(fields, filefields);
+        if (limited) {
+            options->listed++;
+        } else {
+            printfilefields(filefields, fieldwidths, out);
+            filefields = newlist();
+        }
+    }
+    if (filefields == NULL) {
+        errorf("filefields is NULL\n");
+    } else if (limited && length(filefields) > 0) {
+        int *widths = getmaxfilefieldwidths(filefields);
+        printfilefields(filefields, widths, out);
+        free(widths);
+    } else {
+        freelist(filefields, (free_func)freefields);
+    }
+}
+
+/**
+ * Print a sorted one-per-line listing of a directory that's too big
+ * for --max-memory, whose first batch of entries is in files.
+ *
+ * The rest is read a batch at a time, and each batch is formatted and
+ * added to a Sorter, which writes what doesn't fit out to temporary
+ * files, so only the subdirectories are kept as Files.
+ * Above --min-depth nothing is printed, and only the subdirectories are kept.
+ * Returns the subdirectories to list with -R, in the order they'd be listed.
+ */
+static FileList *sortdir(Job *job, DirReader *reader, int dirfd, DirJob *dirjob,
+                         Options *options, FileList *files, FILE *out)
+{
+    bool show = showdir(dirjob, options);
+    unsigned int purpose = prefetchpurpose(dirjob, options);
+    File *dir = dirjob->dir;
+    FileList *subdirs = newlist();
+    Sorter *sorter = NULL;
+    if (show) {
+        sorter = newsorter(options->maxmemory / 2, comparesortentries, options);
+    }
+    if (subdirs == NULL || (show && sorter == NULL)) {
+        errorf("subdirs or sorter is NULL\n");
+        freelist(files, (free_func)freefile);
+        freelist(subdirs, (free_func)noop);
+        return NULL;
+    }
+    unsigned long totalblocks = 0;
+    int *fieldwidths = NULL;
+    int readerror = 0;
+    bool ok = true;
+    bool more = true;
+    while (files) {
+        prefetchfiles(files, options, purpose);
+        if (show && ok) {
+            FileList *listed = filterfiles(files, options);
+            int nlisted = length(listed);
+            for (int i = 0; i < nlisted && ok; i++) {
+                File *file = getitem(listed, i);
+                if (options->dirtotals) {
+                    totalblocks += getblocks(file, options->blocksize);
+                }
+                /* one at a time, so only the Files are held for a whole batch */
+                FieldList *fields = getfilefields(file, options);
+                int nfields = length(fields);
+                if (fieldwidths == NULL) {
+                    fieldwidths = calloc(nfields + 1, sizeof(*fieldwidths));
+                }
+                ok = fields != NULL && fieldwidths != NULL &&
+                     addsortentry(sorter, file, fields, options);
+                for (int j = 0; j < nfields && ok; j++) {
+                    int width = fieldwidth(getitem(fields, j));
+                    if (width > fieldwidths[j]) {
+                        fieldwidths[j] = width;
+                    }
+                }
+                freefields(fields);
+            }
+            if (listed != files) {
+                freelist(listed, (free_func)noop);
+            }
+        }
+        keepsubdirs(files, subdirs, dirjob, options);
+        files = NULL;
+        if (!ok || ferror(out) || jobsstopped(job)) {
+            more = false;
+        }
+        if (more) {
+            files = newlist();
+            if (files == NULL) {
+                errorf("files is NULL\n");
+                break;
+            }
+            more = readentries(reader, dirfd, dir, options, files,
+                               getsortbatchsize(options), &readerror);
+        }
+    }
+    if (readerror != 0) {
+        errorf("Cannot read %s: %s\n", getpath(dir), strerror(readerror));
+    }
+    if (show) {
+        if (options->dirtotals) {
+            fprintf(out, "total %lu\n", totalblocks);
+        }
+        if (ok && sortrecords(sorter)) {
+            printsorted(job, sorter, fieldwidths, options, out);
+        }
+        freesorter(sorter);
+    }
+    free(fieldwidths);
+    sortfiles(subdirs, options);
+    if (options->reverse) {
+        reverselist(subdirs);
+    }
+    return subdirs;
+}
+
+/**
+ * Record which directory dirjob's is, now that it's open as dirfd,
+ * and return true if it's also one of the directories it's inside.
+ *
+ * That means -R has come round in a circle, e.g. through a bind mount,
+ * and would otherwise go round forever.  Only the directories on the way
+ * down are checked, so memory use doesn't grow with the size of the tree,
+ * and a directory that's reachable two ways without a cycle is listed
+ * both times, as in GNU ls.
+ */
+static bool isancestor(DirJob *dirjob, int dirfd)
+{
+    struct stat st;
+    if (fstat(dirfd, &st) != 0) {
+        return false;
+    }
+    dirjob->dev = st.st_dev;
+    dirjob->ino = st.st_ino;
+    dirjob->opened = true;
+    for (DirJob *up = dirjob->parent; up; up = up->parent) {
+        if (up->opened && up->dev == st.st_dev && up->ino == st.st_ino) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Print the contents of the directory in dirjob to out.
+ *
+ * With -R, its subdirectories are added as subjobs of job,
+ * which come out after this directory, in order.
+ */
+void listdir(Job *job, DirJob *dirjob, Options *options, FILE *out)
+{
+    File *dir = dirjob->dir;
+    /* opened relative to the parent directory's fd,
+     * and our entries are looked up relative to this one */
+    int dirfd = opendirectory(dir);
+    if (dirfd != -1 && options->recursive && isancestor(dirjob, dirfd)) {
+        errorf("%s: not listing already-listed directory\n", getpath(dir));
+        close(dirfd);
+        return;
+    }
+
+    /* with --top and -R, entries are offered to options->best,
+     * or with a summary, added to its totals, and nothing's
+     * printed until the whole tree has been */
+    bool collecting = options->best || options->summary;
+    bool show = showdir(dirjob, options);
+    if (show && !collecting) {
+        beginoutput(job, out);
+        if (dirjob->label) {
+            fprintf(out, "%s:\n", getpath(dir));
+        }
+    }
+    if (dirfd == -1) {
+        errorf("Cannot open %s\n", getpath(dir));
+        return;
+    }
+    List *files = newlist();
+    if (files == NULL) {
+        errorf("files in NULL\n");
+        close(dirfd);
+        return;
+    }
+    DirReader *reader = newdirreader(dirfd, options->dirbufsize);
+    if (reader == NULL) {
+        errorf("Cannot read %s: %s\n", getpath(dir), strerror(errno));
+        close(dirfd);
+        freelist(files, (free_func)freefile);
+        return;
+    }
+
+    /* unsorted one-per-line output doesn't need the whole directory
+     * in memory, so huge directories are printed (or selected from)
+     * as they're read, and so are --top's */
+    size_t max = 0;
+    bool oneperline = !show || options->displaymode == DISPLAY_ONE_PER_LINE;
+    bool selecting = show && options->top != 0 && !collecting;
+    if (collecting || selecting || (options->compare == NULL && oneperline)) {
+        max = getbatchsize(options);
+    } else if (options->maxmemory != 0 && options->top == 0 && oneperline) {
+        /* and sorted ones that are too big are sorted through temporary files */
+        max = getsortbatchsize(options);
+    }
+    int readerror = 0;
+    FileList *subdirs = NULL;
+    if (readentries(reader, dirfd, dir, options, files, max, &readerror)) {
+        /* what doesn't fit in a batch is selected from as it's read */
+        Top *top = selecting ? newtop(options->top, comparetopentries, options) : NULL;
+        if (selecting && top == NULL) {
+            errorf("top is NULL\n");
+            freelist(files, (free_func)freefile);
+        } else if (collecting || selecting || options->compare == NULL) {
+            subdirs = streamdir(job, reader, dirfd, dirjob, options, files, top, out);
+        } else {
+            subdirs = sortdir(job, reader, dirfd, dirjob, options, files, out);
+        }
+        freedirreader(reader);
+    } else {
+        freedirreader(reader);
+        subdirs = newlist();
+        if (subdirs == NULL) {
+            errorf("subdirs is NULL\n");
+            close(dirfd);
+            freelist(files, (free_func)freefile);
+            return;
+        }
+
+        /* now that we know all the entries, their stats can be done together */
+        prefetchfiles(files, options, prefetchpurpose(dirjob, options));
+
+        if (readerror != 0) {
+            errorf("Cannot read %s: %s\n", getpath(dir), strerror(readerror));
+        }
+        if (show) {
+            FileList *listed = filterfiles(files, options);
+            unsigned long totalblocks = 0;
+            if (collecting) {
+                collectfiles(listed, options);
+            } else if (options->dirtotals) {
+                int nlisted = length(listed);
+                for (int i = 0; i < nlisted; i++) {
+                    totalblocks += getblocks(getitem(listed, i), options->blocksize);
+                }
+                fprintf(out, "total %lu\n", totalblocks);
+            }
+            if (!collecting) {
+                listfiles(listed, options, out);
+            }
+            if (listed != files) {
+                freelist(listed, (free_func)noop);
+            }
+        }
+        keepsubdirs(files, subdirs, dirjob, options);
+        /* in the order they were, or would have been, listed */
+        if (!show || options->where) {
+            sortfiles(subdirs, options);
+            if (options->reverse) {
+                reverselist(subdirs);
+            }
+        }
+    }
+
+    /*
+     * Only the subdirectories, and dirfd, which they're opened relative to,
+     * are kept while they're listed, so the memory held for each directory
+     * above the one being listed doesn't depend on its size.
+     */
+    int nsubdirs = subdirs ? length(subdirs) : 0;
+    if (limitreached(options)) {
+        /* nothing after this will be listed */
+        stopjobs(job);
+        nsubdirs = 0;
+    }
+    for (int i = 0; i < nsubdirs; i++) {
+        DirJob *subdirjob = newdirjob(getitem(subdirs, i), dirjob, true);
+        if (subdirjob) {
+            addsubjob(job, subdirjob, (free_func)freedirjob);
+        }
+    }
+    dirjob->files = subdirs;
+    if (nsubdirs > 0) {
+        dirjob->dirfd = dirfd;
+    } else {
+        close(dirfd);
+    }
+}
+
+/* the lines drawn by --tree: before an entry, before the last entry,
+ * and under them, before the entries of a subdirectory */
+typedef struct connectors {
+    const char *entry, *last, *under, *underlast;
+} Connectors;
+
+static const Connectors utf8connectors = {
+    "\u251c\u2500\u2500 ", "\u2514\u2500\u2500 ", "\u2502   ", "    "
+};
+static const Connectors asciiconnectors = { "|-- ", "`-- ", "|   ", "    " };
+
+/**
+ * Return true if file, in dirjob's directory, is shown in a --tree.
+ *
+ * Directories that are gone into are shown even if they don't match
+ * --where, so what's under them has somewhere to go.
+ */
+static bool showintree(File *file, DirJob *dirjob, Options *options)
+{
+    return !options->where || matchfile(options->where, file, options->now) ||
+           wantsubdir(file, dirjob, options);
+}
+
+/**
+ * Print the entries of dirjob's directory for --tree, sorted, one per line
+ * after prefix and a connector, going into each subdirectory as it's reached.
+ *
+ * Only the entries of the directories on the way down are held, so memory
+ * depends on the depth of the tree and the size of its directories,
+ * not the number of entries in it.
+ */
+static void listtreedir(DirJob *dirjob, const char *prefix, const Connectors *connectors,
+                        Options *options)
+{
+    File *dir = dirjob->dir;
+    int dirfd = opendirectory(dir);
+    if (dirfd == -1) {
+        errorf("Cannot open %s\n", getpath(dir));
+        return;
+    }
+    if (isancestor(dirjob, dirfd)) {
+        errorf("%s: not listing already-listed directory\n", getpath(dir));
+        close(dirfd);
+        return;
+    }
+    FileList *files = newlist();
+    DirReader *reader = files ? newdirreader(dirfd, options->dirbufsize) : NULL;
+    if (reader == NULL) {
+        errorf("Cannot read %s: %s\n", getpath(dir), strerror(errno));
+        freelist(files, (free_func)freefile);
+        close(dirfd);
+        return;
+    }
+    int readerror = 0;
+    readentries(reader, dirfd, dir, options, files, 0, &readerror);
+    freedirreader(reader);
+    if (readerror != 0) {
+        errorf("Cannot read %s: %s\n", getpath(dir), strerror(readerror));
+    }
+    prefetchfiles(files, options, prefetchpurpose(dirjob, options));
+    sortfiles(files, options);
+    if (options->reverse) {
+        reverselist(files);
+    }
+
+    FileList *shown = newlist();
+    if (shown == NULL) {
+        errorf("shown is NULL\n");
+        freelist(files, (free_func)freefile);
+        close(dirfd);
+        return;
+    }
+    int nfiles = length(files);
+    for (int i = 0; i < nfiles; i++) {
+        File *file = getitem(files, i);
+        /* like tree -a, neither shown nor gone into */
+        if (isdots(file)) {
+            continue;
+        }
+        if (showintree(file, dirjob, options)) {
+            append(file, shown);
+        }
+    }
+    FileList *limited = limitfiles(shown, options);
+    FileFieldList *filefields = map(limited, (map_func)getfilefields, options);
+    int nshown = length(limited);
+    int *fieldwidths = nshown > 0 ? getmaxfilefieldwidths(filefields) : NULL;
+    StringList *filestrings = fieldwidths ? makefilestrings(filefields, fieldwidths) : NULL;
+    free(fieldwidths);
+    freelist(filefields, (free_func)freefields);
+
+    size_t prefixlen = strlen(prefix);
+    for (int i = 0; filestrings && i < nshown && !ferror(stdout); i++) {
+        File *file = getitem(limited, i);
+        bool last = i == nshown - 1;
+        printf("%s%s%s\n", prefix, last ? connectors->last : connectors->entry,
+               (char *)getitem(filestrings, i));
+        if (!wantsubdir(file, dirjob, options) || limitreached(options)) {
+            continue;
+        }
+        const char *under = last ? connectors->underlast : connectors->under;
+        char *subprefix = malloc(prefixlen + strlen(under) + 1);
+        DirJob *subdirjob = subprefix ? newdirjob(file, dirjob, false) : NULL;
+        if (subdirjob == NULL) {
+            errorf("Out of memory\n");
+            free(subprefix);
+            continue;
+        }
+        strcpy(subprefix, prefix);
+        strcpy(subprefix + prefixlen, under);
+        listtreedir(subdirjob, subprefix, connectors, options);
+        freedirjob(subdirjob);
+        free(subprefix);
+    }
+    freelist(filestrings, (free_func)free);
+    if (limited != shown) {
+        freelist(limited, (free_func)noop);
+    }
+    freelist(shown, (free_func)noop);
+    freelist(files, (free_func)freefile);
+    /* only now, since its entries were looked up relative to it */
+    close(dirfd);
+}
+
+/**
+ * List each of dirs with --tree: its name, then everything under it.
+ */
+static void listtrees(FileList *dirs, Options *options, bool firstoutput)
+{
+    const char *codeset = nl_langinfo(CODESET);
+    const Connectors *connectors = codeset && strcmp(codeset, "UTF-8") == 0 ?
+                                   &utf8connectors : &asciiconnectors;
+    int ndirs = length(dirs);
+    for (int i = 0; i < ndirs && !limitreached(options) && !ferror(stdout); i++) {
+        File *dir = getitem(dirs, i);
+        if (i > 0 || !firstoutput) {
+            putchar('\n');
+        }
+        Field *name = getnamefield(dir, options);
+        if (name) {
+            printf("%s\n", fieldstring(name));
+            freefield(name);
+        }
+        DirJob *dirjob = newdirjob(dir, NULL, false);
+        if (dirjob) {
+            listtreedir(dirjob, "", connectors, options);
+            freedirjob(dirjob);
+        }
+    }
+}
+
+/**
+ * Run by runjobs() for each directory.
+ */
+static void listdirjob(Job *job, void *arg, FILE *out, void *context)
+{
+    listdir(job, arg, context, out);
+}
+
+/**
+ * List the contents of each of dirs, and with -R, their subdirectories.
+ *
+ * Directories are read, sorted, and formatted on up to options->threads
+ * threads at once, but come out in the same order as if they were
+ * listed one at a time, depth first.
+ */
+void listdirs(FileList *dirs, Options *options, bool firstoutput)
+{
+    if (!dirs) return;
+    if (options->tree) {
+        /* depth-first, as it's drawn */
+        listtrees(dirs, options, firstoutput);
+        return;
+    }
+    int ndirs = length(dirs);
+    /* with --files-from, more directories may be read after these */
+    bool needlabel = ndirs > 1 || !firstoutput || options->recursive || options->filesfrom;
+    /* one directory, and no subdirectories, is just done here;
+     * --limit counts entries as they're listed, so directories are
+     * listed one at a time, in output order */
+    int nthreads = (ndirs > 1 || options->recursive) && options->limit == 0 ?
+                   options->threads : 1;
+    Jobs *jobs = newjobs(nthreads, listdirjob, options);
+    if (!jobs) {
+        errorf("jobs is NULL\n");
+        return;
+    }
+    /* with --min-depth, which directories print anything isn't known
+     * until they're read, so the blank lines between them are left to jobs */
+    setseparator(jobs, "\n", !firstoutput);
+    if (options->queuedepth != 0) {
+        setqueuedepth(jobs, options->queuedepth);
+    }
+    for (int i = 0; i < ndirs; i++) {
+        File *dir = getitem(dirs, i);
+        if (!dir) {
+            error("dir is NULL\n");
+            continue;
+        }
+        DirJob *dirjob = newdirjob(dir, NULL, needlabel);
+        if (dirjob) {
+            addjob(jobs, dirjob, (free_func)freedirjob);
+        }
+    }
+    runjobs(jobs);
+    freejobs(jobs);
 }
 
 /**
@@ -448,9 +1854,10 @@ void sortfiles(List *files, Options *options)
     sortlist(files, compare);
 }
 
-void printwithnewline(void *string)
+void printwithnewline(void *string, void *out)
 {
-    puts((char *)string);
+    fputs(string, out);
+    fputc('\n', out);
 }
 
 bool islinktodir(File *file)
@@ -479,9 +1886,6 @@ bool want(File *file, Options *options)
     if (file == NULL) {
         errorf("file is NULL\n");
         return 0;
-    } else if (getpath(file) == NULL) {
-        errorf("path is NULL\n");
-        return 0;
     } else if (options == NULL) {
         errorf("options is NULL\n");
         return 0;
@@ -1,27 +1,69 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "list.h"
 #include "logging.h"
 
 List *newlist(void)
+{
+    return newlistcap(0);
+}
+
+List *newlistcap(unsigned capacity)
 {
     List *list = malloc(sizeof *list);
     if (!list) {
         errorf("Out of memory\n");
         return NULL;
     }
-    list->capacity = 1024;
     list->next = 0;
-    list->data = malloc(list->capacity * sizeof(void *));
+    if (capacity <= LIST_INLINE) {
+        list->capacity = LIST_INLINE;
+        list->data = list->small;
+        return list;
+    }
+    list->capacity = capacity;
+    list->data = malloc(capacity * sizeof(void *));
     if (!list->data) {
+        errorf("Out of memory\n");
         free(list);
         return NULL;
     }
     return list;
 }
 
+/**
+ * Make room for at least one more item, doubling the capacity so that
+ * appending n items copies fewer than 2n.
+ */
+static bool grow(List *list)
+{
+    if (list->capacity > UINT_MAX / 2) {
+        errorf("Too many items\n");
+        return false;
+    }
+    unsigned capacity = list->capacity * 2;
+    void **newdata;
+    if (list->data == list->small) {
+        newdata = malloc(capacity * sizeof(*newdata));
+        if (newdata) {
+            memcpy(newdata, list->small, list->next * sizeof(*newdata));
+        }
+    } else {
+        newdata = realloc(list->data, capacity * sizeof(*newdata));
+    }
+    if (!newdata) {
+        errorf("Out of memory\n");
+        return false;
+    }
+    list->capacity = capacity;
+    list->data = newdata;
+    return true;
+}
+
 void freelist(List *list, free_func freeelem)
 {
     if (!list) return;
@@ -33,7 +75,9 @@ void freelist(List *list, free_func freeelem)
             elem = NULL;
         }
     }
-    free(list->data);
+    if (list->data != list->small) {
+        free(list->data);
+    }
     list->data = NULL;
     free(list);
 }
@@ -41,14 +85,8 @@ void freelist(List *list, free_func freeelem)
 void append(void *element, List *list)
 {
     if (!list) return;
-    if (list->next == list->capacity) {
-        void **newdata = realloc(list->data, (list->capacity+1024)*sizeof(*newdata));
-        if (!newdata) {
-            errorf("Out of memory\n");
-            return;
-        }
-        list->capacity += 1024;
-        list->data = newdata;
+    if (list->next == list->capacity && !grow(list)) {
+        return;
     }
     (list->data)[list->next++] = element;
 }
@@ -99,7 +137,7 @@ List *map(List *list, map_func func, void *context)
         errorf("list is NULL\n");
         return NULL;
     }
-    List *resultlist = newlist();
+    List *resultlist = newlistcap(length(list));
     if (resultlist == NULL) {
         errorf("result is NULL\n");
         return NULL;
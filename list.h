@@ -3,9 +3,18 @@
 
 #include <stdbool.h>
 
+/* items held in the list itself, before any are allocated */
+#define LIST_INLINE 4
+
+/*
+ * Most lists (a file's fields, a map's slots) hold a few items, so those
+ * are kept in the list, and storage is only allocated once it outgrows
+ * them, doubling each time after that.
+ */
 struct list {
-    void **data;
+    void **data;                    /* items, or small */
     unsigned capacity, next;
+    void *small[LIST_INLINE];
 };
 typedef struct list List;
 
@@ -20,6 +29,8 @@ typedef int (*printer_func)(void *elem, void *pvoptions);
 typedef int (*width_func)(void *elem, void *pvoptions);
 
 List *newlist(void);
+/* a list with room for capacity items before it has to grow */
+List *newlistcap(unsigned capacity);
 void freelist(List *list, free_func freeelem);
 
 void append(void *element, List *list);
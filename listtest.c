@@ -14,6 +14,9 @@ void test_reverselist_even(void);
 void test_reverselist_single(void);
 void test_setitem_out_of_bounds(void);
 void test_finditem(void);
+void test_grow_past_small(void);
+void test_newlistcap(void);
+void test_map_presized(void);
 
 int main(int argc, const char *argv[])
 {
@@ -27,6 +30,9 @@ int main(int argc, const char *argv[])
     test_reverselist_single();
     test_setitem_out_of_bounds();
     test_finditem();
+    test_grow_past_small();
+    test_newlistcap();
+    test_map_presized();
 
     return 0;
 }
@@ -304,4 +310,79 @@ void test_finditem(void)
     freelist(list, free);
 }
 
+void test_grow_past_small(void)
+{
+    List *list = newlist();
+    static int items[100000];
+
+    /* a few items are held in the list itself */
+    assert(list->capacity == LIST_INLINE);
+    assert(list->data == list->small);
+
+    for (int i = 0; i < 100000; i++) {
+        items[i] = i;
+        append(&items[i], list);
+        assert(length(list) == i + 1);
+    }
+    assert(list->data != list->small);
+    /* doubled, not grown a step at a time */
+    assert(list->capacity >= 100000 && list->capacity < 200000);
+    assert((list->capacity & (list->capacity - 1)) == 0);
+    for (int i = 0; i < 100000; i++) {
+        assert(getitem(list, i) == &items[i]);
+    }
+    freelist(list, (free_func)donothing);
+}
+
+void test_newlistcap(void)
+{
+    int items[10];
+
+    /* exactly as many as asked for, so filling it doesn't reallocate */
+    List *list = newlistcap(10);
+    assert(list->capacity == 10);
+    for (int i = 0; i < 10; i++) {
+        append(&items[i], list);
+    }
+    assert(list->capacity == 10);
+    append(&items[0], list);
+    assert(list->capacity == 20);
+    assert(getitem(list, 9) == &items[9] && getitem(list, 10) == &items[0]);
+    freelist(list, (free_func)donothing);
+
+    /* no smaller than what the list holds itself */
+    list = newlistcap(1);
+    assert(list->data == list->small);
+    for (int i = 0; i < LIST_INLINE; i++) {
+        append(&items[i], list);
+    }
+    assert(list->data == list->small);
+    freelist(list, (free_func)donothing);
+}
+
+static void *doubleint(void *elem, void *context)
+{
+    int *pi = malloc(sizeof *pi);
+    *pi = *(int *)elem * 2;
+    return pi;
+}
+
+void test_map_presized(void)
+{
+    List *list = newlist();
+    int items[1000];
+
+    for (int i = 0; i < 1000; i++) {
+        items[i] = i;
+        append(&items[i], list);
+    }
+    List *doubled = map(list, doubleint, NULL);
+    assert(doubled->capacity == 1000);
+    for (int i = 0; i < 1000; i++) {
+        assert(*(int *)getitem(doubled, i) == 2 * i);
+    }
+    freelist(doubled, free);
+    freelist(list, (free_func)donothing);
+}
+
 /* vim: set ts=4 sw=4 tw=0 et:*/
@@ -1,10 +1,67 @@
+#define _POSIX_C_SOURCE 200809L /* for open_memstream() */
+
 #include "logging.h"
 
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 char *myname;
 
+/* per-thread error handler, see seterrorhandler() */
+struct handler {
+    error_handler func;
+    void *context;
+};
+static pthread_key_t handlerkey;
+static pthread_once_t handlerkeyonce = PTHREAD_ONCE_INIT;
+
+static void makehandlerkey(void)
+{
+    pthread_key_create(&handlerkey, free);
+}
+
+void seterrorhandler(error_handler func, void *context)
+{
+    pthread_once(&handlerkeyonce, makehandlerkey);
+    struct handler *handler = pthread_getspecific(handlerkey);
+    if (!func) {
+        free(handler);
+        pthread_setspecific(handlerkey, NULL);
+        return;
+    }
+    if (!handler) {
+        handler = malloc(sizeof(*handler));
+        if (!handler) {
+            /* errors will just go to stderr */
+            return;
+        }
+        pthread_setspecific(handlerkey, handler);
+    }
+    handler->func = func;
+    handler->context = context;
+}
+
+void geterrorhandler(error_handler *pfunc, void **pcontext)
+{
+    pthread_once(&handlerkeyonce, makehandlerkey);
+    struct handler *handler = pthread_getspecific(handlerkey);
+    *pfunc = handler ? handler->func : NULL;
+    *pcontext = handler ? handler->context : NULL;
+}
+
+void reporterror(const char *message)
+{
+    pthread_once(&handlerkeyonce, makehandlerkey);
+    struct handler *handler = pthread_getspecific(handlerkey);
+    if (handler) {
+        handler->func(message, handler->context);
+    } else {
+        fputs(message, stderr);
+    }
+}
+
 void copystring(const char *str, char **pbuf, int *pbufsize)
 {
     char *buf = *pbuf;
@@ -27,20 +84,40 @@ void copystring(const char *str, char **pbuf, int *pbufsize)
 
 void errorf2(const char *func, const char *format, ...)
 {
+    pthread_once(&handlerkeyonce, makehandlerkey);
+    struct handler *handler = pthread_getspecific(handlerkey);
+    char *message = NULL;
+    size_t size = 0;
+    FILE *stream = stderr;
+    if (handler) {
+        stream = open_memstream(&message, &size);
+        if (!stream) {
+            /* better out of order than lost */
+            stream = stderr;
+            handler = NULL;
+        }
+    }
+
     va_list ap;
     va_start(ap, format);
     if (myname) {
-        fputs(myname, stderr);
-        fputs(": ", stderr);
+        fputs(myname, stream);
+        fputs(": ", stream);
     }
     if (func) {
-        fputs(func, stderr);
-        fputs(": ", stderr);
+        fputs(func, stream);
+        fputs(": ", stream);
     }
     if (format) {
-        vfprintf(stderr, format, ap);
+        vfprintf(stream, format, ap);
     }
     va_end(ap);
+
+    if (handler) {
+        fclose(stream);
+        handler->func(message, handler->context);
+        free(message);
+    }
 }
 
 /* vim: set ts=4 sw=4 tw=0 et:*/
@@ -46,5 +46,27 @@ void copystring(const char *str, char **pbuf, int *pbufsize);
  */
 void errorf2(const char *func, const char *format, ...);
 
+typedef void (*error_handler)(const char *message, void *context);
+
+/**
+ * Pass the calling thread's error messages to func instead of printing them.
+ *
+ * func is called with the whole message and context.
+ * Pass NULL to go back to printing them to stderr.
+ */
+void seterrorhandler(error_handler func, void *context);
+
+/**
+ * Get the calling thread's error handler, NULL if messages are printed,
+ * e.g. to put it back after seterrorhandler().
+ */
+void geterrorhandler(error_handler *pfunc, void **pcontext);
+
+/**
+ * Print message, the whole of an error message captured by a handler,
+ * or pass it to the calling thread's handler.
+ */
+void reporterror(const char *message);
+
 #endif
 /* vim: set ts=4 sw=4 tw=0 et:*/
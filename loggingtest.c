@@ -8,6 +8,7 @@
 void test_copystring_with_string_that_fits();
 void test_copystring_with_string_thats_too_long();
 void test_errorf_output_includes_function_name();
+void test_seterrorhandler_captures_messages();
 
 int main(int argc, char **argv)
 {
@@ -16,6 +17,7 @@ int main(int argc, char **argv)
     test_errorf_output_includes_function_name();
     test_copystring_with_string_that_fits();
     test_copystring_with_string_thats_too_long();
+    test_seterrorhandler_captures_messages();
     return 0;
 }
 
@@ -47,3 +49,18 @@ void test_copystring_with_string_thats_too_long()
     assert(strcmp(origbuf, "abc") == 0);
     assert(bufsize == 0);
 }
+
+static void savemessage(const char *message, void *context)
+{
+    char *saved = context;
+    strcpy(saved, message);
+}
+
+void test_seterrorhandler_captures_messages()
+{
+    char saved[100] = "";
+    seterrorhandler(savemessage, saved);
+    errorf("captured %d\n", 42);
+    seterrorhandler(NULL, NULL);
+    assert(strcmp(saved, "loggingtest: test_seterrorhandler_captures_messages: captured 42\n") == 0);
+}
@@ -7,22 +7,35 @@
 #define _POSIX_C_SOURCE 200809L /* needed to make getopt() and opt* visible */
 
 #include <sys/ioctl.h>
+#include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
+#include "dir.h"
 #include "display.h"
 #include "logging.h"
 #include "map.h"
 #include "options.h"
+#include "pattern.h"
+#include "pool.h"
+#include "predicate.h"
 
 void freeoptions(Options *options)
 {
     if (!options) return;
     freemap(options->usernames);
     freemap(options->groupnames);
+    freepatterns(options->ignore);
+    freepatterns(options->include);
+    freepredicate(options->where);
     freecolors(options->colors);
+    freepool(options->pool);
     free(options);
 }
 
@@ -47,20 +60,32 @@ void setdefaults(Options *options)
     options->compatible = true;
     options->datetime = false;
     options->directory = false;
+    options->dirbufsize = DIRBUFSIZE;
     options->dirsonly = false;
     options->dirtotals = false;
     options->displaymode = DISPLAY_ONE_PER_LINE;
     options->escape = ESCAPE_NONE;
+    options->filesfrom = NULL;
     options->flags = FLAGS_NONE;
     options->followdirlinkargs = DEFAULT; /* see setoptions() for rules */
     options->group = false;
+    options->ignore = NULL;
+    options->include = NULL;
     options->inode = false;
+    options->limit = 0;
     options->linkcount = false;
     options->longformat = false;
+    options->lookahead = LOOKAHEAD;
+    options->maxdepth = -1;
+    options->maxmemory = 0;
+    options->mindepth = 0;
     options->modes = false;
+    options->nullpaths = false;
     options->numeric = false;
+    options->onefilesystem = false;
     options->owner = false;
     options->perms = false;
+    options->queuedepth = 0;
     options->recursive = false;
     options->reverse = false;
     options->showlink = false;
@@ -68,15 +93,28 @@ void setdefaults(Options *options)
     options->size = false;
     options->sizestyle = SIZE_DEFAULT;
     options->sorttype = SORT_BY_NAME;
+    options->summarize = SUMMARIZE_NONE;
     options->targetinfo = DEFAULT;
+    options->threads = 0;
+    options->top = 0;
+    options->tree = false;
+    options->treesize = false;
+    options->where = NULL;
     options->timestyle = TIME_TRADITIONAL;
     options->timetype = TIME_MTIME;
 
+    options->best = NULL;
     options->compare = NULL;
+    options->fullpaths = false;
     options->groupnames = NULL;
+    options->listed = 0;
     options->now = -1;
     options->colors = NULL;
     options->screenwidth = 0;
+    options->needstat = false;
+    options->pool = NULL;
+    options->statfields = 0;
+    options->summary = NULL;
     options->timeformat = NULL;
     options->usernames = NULL;
 
@@ -113,7 +151,17 @@ static struct option longopts[] = {
     {"all",                       no_argument,       NULL, 'a'},
     {"directory",                 no_argument,       NULL, 'd'},
     {"dirs-only",                 no_argument,       NULL, 'D'},
+    {"files-from",                required_argument, NULL, 0  },
+    {"ignore",                    required_argument, NULL, 0  },
+    {"ignore-from",               required_argument, NULL, 0  },
+    {"include",                   required_argument, NULL, 0  },
+    {"limit",                     required_argument, NULL, 0  },
+    {"max-depth",                 required_argument, NULL, 0  },
+    {"min-depth",                 required_argument, NULL, 0  },
+    {"null",                      no_argument,       NULL, '0'},
+    {"one-file-system",           no_argument,       NULL, 0  },
     {"recursive",                 no_argument,       NULL, 'R'},
+    {"where",                     required_argument, NULL, 0  },
 
     /* metadata fields */
     {"bytes",                     no_argument,       NULL, 'B'},
@@ -126,6 +174,7 @@ static struct option longopts[] = {
     {"perms",                     no_argument,       NULL, 'p'},
     {"size",                      no_argument,       NULL, 's'},
     {"show-time",                 no_argument,       NULL, 'T'},
+    {"tree-size",                 no_argument,       NULL, 0  },
 
     /* long format */
     {"long",                      no_argument,       NULL, 'l'},
@@ -134,11 +183,17 @@ static struct option longopts[] = {
     {"columns",                   no_argument,       NULL, 'C'},
     {"one-per-line",              no_argument,       NULL, '1'},
     {"rows",                      no_argument,       NULL, 'x'},
+    {"tree",                      no_argument,       NULL, 0  },
 
     /* sorting */
     {"reverse",                   no_argument,       NULL, 'r'},
+    {"top",                       required_argument, NULL, 0  },
     {"unsorted",                  no_argument,       NULL, 'U'},
 
+    /* summarizing */
+    {"count",                     no_argument,       NULL, 0  },
+    {"summarize-by",              required_argument, NULL, 0  },
+
     /* escaping */
     {"escape",                    no_argument,       NULL, 'e'},
     {"hide-control-chars",        no_argument,       NULL, 'q'},
@@ -172,11 +227,154 @@ static struct option longopts[] = {
     {"time",                      required_argument, NULL, 0  },
     {"time-style",                required_argument, NULL, 0  },
 
+    /* tuning */
+    {"lookahead",                 required_argument, NULL, 0  },
+    {"max-memory",                required_argument, NULL, 0  },
+    {"queue-depth",               required_argument, NULL, 0  },
+    {"readdir-buffer",            required_argument, NULL, 0  },
+    {"threads",                   required_argument, NULL, 0  },
+
     {NULL, 0, NULL, 0},
 };
 
 static int longindex = 0;
 
+/**
+ * Return the statx() fields needed to show times of the given type.
+ */
+static unsigned int gettimefield(enum timetype timetype)
+{
+    switch (timetype) {
+    case TIME_ATIME: return STAT_ATIME;
+    case TIME_BTIME: return STAT_BTIME;
+    case TIME_CTIME: return STAT_CTIME;
+    case TIME_MTIME: return STAT_MTIME;
+    }
+    return STAT_MTIME;
+}
+
+/**
+ * Work out which metadata the enabled fields and sort order need,
+ * so that each file needs only one statx() that fetches only that.
+ */
+static unsigned int getstatfields(Options *options)
+{
+    /* no fields are shown or sorted by */
+    if (options->summarize != SUMMARIZE_NONE) {
+        return getsummaryfields(options->summarize) | getpredicatefields(options->where);
+    }
+
+    unsigned int fields = 0;
+    if (options->size || options->dirtotals) fields |= STAT_BLOCKS;
+    /* hard links are only counted once */
+    if (options->treesize)  fields |= STAT_BLOCKS | STAT_NLINK | STAT_INO;
+    if (options->inode)     fields |= STAT_INO;
+    if (options->linkcount) fields |= STAT_NLINK;
+    if (options->owner)     fields |= STAT_UID;
+    if (options->group)     fields |= STAT_GID;
+    if (options->bytes)     fields |= STAT_SIZE;
+    if (options->datetime)  fields |= gettimefield(options->timetype);
+    /* symlink loops are detected by inode number */
+    if (options->showlinks || options->targetinfo) fields |= STAT_INO;
+    fields |= getpredicatefields(options->where);
+
+    switch (options->sorttype) {
+    case SORT_BY_TIME:
+        fields |= gettimefield(options->timetype);
+        break;
+    case SORT_BY_SIZE:
+        fields |= STAT_SIZE;
+        break;
+    default:
+        break;
+    }
+    return fields;
+}
+
+/**
+ * Parse a size such as "4096", "256K", or "1M".
+ *
+ * Suffixes are binary (K = 1024).
+ *
+ * Returns true on success, false if it isn't a size or doesn't fit in a size_t.
+ */
+static bool parsesize(const char *s, size_t *psize)
+{
+    char *end;
+    errno = 0;
+    unsigned long long size = strtoull(s, &end, 10);
+    if (errno != 0 || !isdigit((unsigned char)*s)) {
+        return false;
+    }
+    unsigned long long scale = 1;
+    switch (*end) {
+    case 'K': case 'k':
+        scale = 1024ULL, end++;
+        break;
+    case 'M': case 'm':
+        scale = 1024ULL * 1024, end++;
+        break;
+    case 'G': case 'g':
+        scale = 1024ULL * 1024 * 1024, end++;
+        break;
+    }
+    if (*end != '\0' || size > SIZE_MAX / scale) {
+        return false;
+    }
+    *psize = size * scale;
+    return true;
+}
+
+/**
+ * Parse a count of entries or directories, a plain decimal number
+ * with no suffix, for --limit, --top and --queue-depth.
+ *
+ * Returns true on success.
+ */
+static bool parsecount(const char *s, size_t *pcount)
+{
+    char *end;
+    errno = 0;
+    unsigned long long count = strtoull(s, &end, 10);
+    if (errno != 0 || !isdigit((unsigned char)*s) || *end != '\0' || count > SIZE_MAX) {
+        return false;
+    }
+    *pcount = count;
+    return true;
+}
+
+/**
+ * Return *ppatterns, creating it the first time,
+ * so patterns from every --ignore (or --include) go in one set.
+ */
+static Patterns *getpatterns(Patterns **ppatterns)
+{
+    if (!*ppatterns) {
+        *ppatterns = newpatterns();
+        if (!*ppatterns) {
+            exit(1);
+        }
+    }
+    return *ppatterns;
+}
+
+/**
+ * Parse a directory depth for --max-depth or --min-depth into *pdepth.
+ *
+ * Returns true on success.
+ */
+static bool parsedepth(const char *s, int *pdepth)
+{
+    char *end;
+    errno = 0;
+    long depth = strtol(s, &end, 10);
+    if (errno != 0 || end == s || *end != '\0' || depth < 0 || depth > INT_MAX) {
+        return false;
+    }
+    *pdepth = depth;
+    return true;
+}
+
 int setoptions(Options *options, int argc, char **argv)
 {
     opterr = 0;     /* we will print our own error messages */
@@ -186,6 +384,8 @@ int setoptions(Options *options, int argc, char **argv)
         case 0:
             if (strcmp(longopts[longindex].name, "atime") == 0) {
                 options->timetype = TIME_ATIME;
+            } else if (strcmp(longopts[longindex].name, "one-file-system") == 0) {
+                options->onefilesystem = true;
             } else if (strcmp(longopts[longindex].name, "btime") == 0) {
                 options->timetype = TIME_BTIME;
             } else if (strcmp(longopts[longindex].name, "ctime") == 0) {
@@ -230,6 +430,91 @@ int setoptions(Options *options, int argc, char **argv)
                     error("Unsupported time type '%s'\n", optarg);
                     exit(2);
                 }
+            } else if (strcmp(longopts[longindex].name, "tree") == 0) {
+                options->tree = true;
+            } else if (strcmp(longopts[longindex].name, "tree-size") == 0) {
+                options->treesize = true;
+            } else if (strcmp(longopts[longindex].name, "ignore") == 0) {
+                if (!addpattern(getpatterns(&options->ignore), optarg)) {
+                    exit(1);
+                }
+            } else if (strcmp(longopts[longindex].name, "ignore-from") == 0) {
+                if (!readpatterns(getpatterns(&options->ignore), optarg)) {
+                    error("Cannot read %s: %s\n", optarg, strerror(errno));
+                    exit(2);
+                }
+            } else if (strcmp(longopts[longindex].name, "include") == 0) {
+                if (!addpattern(getpatterns(&options->include), optarg)) {
+                    exit(1);
+                }
+            } else if (strcmp(longopts[longindex].name, "where") == 0) {
+                const char *problem, *where;
+                freepredicate(options->where);
+                options->where = parsepredicate(optarg, &problem, &where);
+                if (!options->where) {
+                    error("Invalid --where expression: %s at '%s'\n", problem, where);
+                    exit(2);
+                }
+            } else if (strcmp(longopts[longindex].name, "files-from") == 0) {
+                options->filesfrom = optarg;
+            } else if (strcmp(longopts[longindex].name, "limit") == 0) {
+                if (!parsecount(optarg, &options->limit) || options->limit == 0) {
+                    error("Invalid limit '%s'\n", optarg);
+                    exit(2);
+                }
+            } else if (strcmp(longopts[longindex].name, "top") == 0) {
+                if (!parsecount(optarg, &options->top) || options->top == 0) {
+                    error("Invalid top '%s'\n", optarg);
+                    exit(2);
+                }
+            } else if (strcmp(longopts[longindex].name, "count") == 0) {
+                options->summarize = SUMMARIZE_COUNT;
+            } else if (strcmp(longopts[longindex].name, "summarize-by") == 0) {
+                if (!parsesummarize(optarg, &options->summarize)) {
+                    error("Unsupported summarize-by '%s'\n", optarg);
+                    exit(2);
+                }
+            } else if (strcmp(longopts[longindex].name, "max-depth") == 0) {
+                if (!parsedepth(optarg, &options->maxdepth)) {
+                    error("Invalid max depth '%s'\n", optarg);
+                    exit(2);
+                }
+                options->recursive = true;
+            } else if (strcmp(longopts[longindex].name, "min-depth") == 0) {
+                if (!parsedepth(optarg, &options->mindepth)) {
+                    error("Invalid min depth '%s'\n", optarg);
+                    exit(2);
+                }
+                options->recursive = true;
+            } else if (strcmp(longopts[longindex].name, "lookahead") == 0) {
+                if (!parsesize(optarg, &options->lookahead)) {
+                    error("Invalid lookahead '%s'\n", optarg);
+                    exit(2);
+                }
+            } else if (strcmp(longopts[longindex].name, "max-memory") == 0) {
+                if (!parsesize(optarg, &options->maxmemory) || options->maxmemory == 0) {
+                    error("Invalid max memory '%s'\n", optarg);
+                    exit(2);
+                }
+            } else if (strcmp(longopts[longindex].name, "queue-depth") == 0) {
+                if (!parsecount(optarg, &options->queuedepth) || options->queuedepth == 0 ||
+                    options->queuedepth > INT_MAX) {
+                    error("Invalid queue depth '%s'\n", optarg);
+                    exit(2);
+                }
+            } else if (strcmp(longopts[longindex].name, "readdir-buffer") == 0) {
+                if (!parsesize(optarg, &options->dirbufsize) || options->dirbufsize == 0) {
+                    error("Invalid readdir buffer size '%s'\n", optarg);
+                    exit(2);
+                }
+            } else if (strcmp(longopts[longindex].name, "threads") == 0) {
+                char *end;
+                long threads = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || threads < 1 || threads > MAXTHREADS) {
+                    error("Invalid number of threads '%s'\n", optarg);
+                    exit(2);
+                }
+                options->threads = threads;
             } else if (strcmp(longopts[longindex].name, "format") == 0) {
                 if (strcmp(optarg, "long") == 0 || strcmp(optarg, "verbose") == 0) {
                     options->longformat = true;
@@ -254,6 +539,9 @@ int setoptions(Options *options, int argc, char **argv)
                 }
             }
             break;
+        case '0':
+            options->nullpaths = true;
+            break;
         case '1':
             options->displaymode = DISPLAY_ONE_PER_LINE;
             break;
@@ -422,6 +710,28 @@ int setoptions(Options *options, int argc, char **argv)
         options->sorttype = SORT_BY_TIME;
     }
 
+    if (options->nullpaths && !options->filesfrom) {
+        error("Cannot use -0 without --files-from\n");
+        goto error;
+    }
+    if (options->summarize != SUMMARIZE_NONE) {
+        if (options->top != 0) {
+            error("Cannot use --top with --summarize-by or --count\n");
+            goto error;
+        }
+        /* totals don't depend on the order, so entries are streamed */
+        options->sorttype = SORT_UNSORTED;
+    }
+    if (options->tree) {
+        if (options->top != 0 || options->summarize != SUMMARIZE_NONE) {
+            error("Cannot use --tree with --top, --summarize-by or --count\n");
+            goto error;
+        }
+        /* each entry on a line of its own, after the connectors */
+        options->displaymode = DISPLAY_ONE_PER_LINE;
+        options->recursive = true;
+    }
+
     switch (options->sorttype) {
     case SORT_BY_NAME:
         options->compare = &comparebyname;
@@ -465,6 +775,11 @@ int setoptions(Options *options, int argc, char **argv)
         break;
     }
 
+    if (options->top != 0 && options->compare == NULL) {
+        error("Cannot use --top without sorting\n");
+        goto error;
+    }
+
     /* if -H was not given, set it based on other flags...*/
     if (options->followdirlinkargs == DEFAULT) {
         if (options->targetinfo != DEFAULT) {
@@ -487,6 +802,18 @@ int setoptions(Options *options, int argc, char **argv)
       options->showlink = false;
     }
 
+    if (options->threads == 0) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        options->threads = ncpus < 1 ? 1 : ncpus > MAXTHREADS ? MAXTHREADS : ncpus;
+    }
+
+    options->statfields = getstatfields(options);
+    setstatfields(options->statfields);
+    /* -F and colors need the mode to spot executables */
+    options->needstat = (options->statfields & ~STAT_INO) ||
+                        (options->summarize == SUMMARIZE_NONE &&
+                         (options->modes || options->flags != FLAGS_NONE || options->color));
+
     if (options->color) {
         Colors *colors = malloc(sizeof(*colors));
         if (!colors) {
@@ -498,7 +825,8 @@ int setoptions(Options *options, int argc, char **argv)
         options->colors = colors;
     }
 
-    if (options->datetime) {
+    /* --where ages are relative to now too */
+    if (options->datetime || options->where) {
         options->now = time(NULL);
         if (options->now == -1) {
             errorf("Cannot determine current time\n");
@@ -506,14 +834,14 @@ int setoptions(Options *options, int argc, char **argv)
         }
     }
 
-    if (options->group && !options->numeric) {
+    if ((options->group || options->summarize == SUMMARIZE_GROUP) && !options->numeric) {
         options->groupnames = newmap();
         if (!options->groupnames) {
             errorf("Out of memory?\n");
             goto error;
         }
     }
-    if (options->owner && !options->numeric) {
+    if ((options->owner || options->summarize == SUMMARIZE_OWNER) && !options->numeric) {
         options->usernames = newmap();
         if (!options->usernames) {
             errorf("Out of memory?\n");
@@ -540,7 +868,18 @@ void usage(void)
         "  -a, --all                  show hidden files\n"
         "  -D, --dirs-only            show only directories\n"
         "  -d, --directory            list directory names, not contents\n"
+        "      --files-from=FILE      list the paths in FILE (- = stdin), one per line,\n"
+        "                               instead of arguments\n"
+        "  -0, --null                 with --files-from, paths end with NUL, not newline\n"
+        "      --ignore=GLOB          don't list or go into files matching GLOB\n"
+        "      --ignore-from=FILE     --ignore each line of FILE\n"
+        "      --include=GLOB         only list files (not directories) matching GLOB\n"
+        "      --limit=N              stop after listing N entries\n"
         "  -R, --recursive            list subdirectories recursively\n"
+        "      --max-depth=N          -R, but not below N levels (0 = arguments only)\n"
+        "      --min-depth=N          -R, but only list directories N or more levels down\n"
+        "      --one-file-system      with -R, skip directories on other file systems\n"
+        "      --where=EXPR           only list files matching EXPR, e.g. 'size > 1M && type == f'\n"
         "\n"
         "Metadata fields:\n"
         "  -B, -b, --bytes            show file size in bytes\n"
@@ -553,6 +892,8 @@ void usage(void)
         "  -p, --perms                show current user's permissions\n"
         "  -s, --size                 show size in blocks\n"
         "  -T, --show-time            show date/time\n"
+        "      --tree-size            show blocks and entries in everything under\n"
+        "                               each directory, like du -s\n"
         "\n"
         "Long format:\n"
         "  -l, --long                 long format (equivalent to -MNogBT1)\n"
@@ -561,14 +902,22 @@ void usage(void)
         "  -C, --columns              multi-column output (sorted down)\n"
         "  -x, --rows                 multi-column output (sorted across)\n"
         "  -1, --one-per-line         one entry per line\n"
+        "      --tree                 list subdirectories recursively as a tree\n"
         "\n"
         "Sorting:\n"
         "  -r, --reverse              reverse sort order\n"
         "  -S                         sort by size\n"
         "  -t                         sort by time\n"
         "  -v                         sort by version\n"
+        "      --top=N                list only the first N entries in sort order,\n"
+        "                               with -R of the whole tree\n"
         "  -U, -f, --unsorted         do not sort\n"
         "\n"
+        "Summarizing:\n"
+        "      --count                print only the number of entries\n"
+        "      --summarize-by=KEY     print entries, bytes, and blocks per owner, group,\n"
+        "                               ext, type, or mtime-month, instead of entries\n"
+        "\n"
         "Escaping:\n"
         "  -e, --escape               C-style escape sequences\n"
         "  -E, --no-escape            no escaping\n"
@@ -595,6 +944,18 @@ void usage(void)
         "                               vertical, across\n"
         "      --sort=WORD            sort by: name, size, time, version, none\n"
         "      --time=WORD            time type: mtime, atime, ctime, btime\n"
-        "      --time-style=STYLE     time format: traditional, relative\n",
+        "      --time-style=STYLE     time format: traditional, relative\n"
+        "\n"
+        "Tuning:\n"
+        "      --lookahead=N          entries to read before printing unsorted\n"
+        "                               one-per-line output (default 64K, 0 = all)\n"
+        "      --max-memory=SIZE      sort directories bigger than about SIZE\n"
+        "                               through temporary files\n"
+        "      --queue-depth=N        directories to read and format ahead of\n"
+        "                               the output with -R (default 8 per thread)\n"
+        "      --readdir-buffer=SIZE  bytes of directory entries to read at once\n"
+        "                               (default 256K)\n"
+        "      --threads=N            threads to fetch metadata of large\n"
+        "                               directories with (default: CPU count)\n",
         myname, OPTSTRING);
 }
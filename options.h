@@ -9,8 +9,13 @@
 #include "file.h"
 #include "logging.h"
 #include "map.h"
+#include "pattern.h"
+#include "pool.h"
+#include "predicate.h"
+#include "summary.h"
+#include "top.h"
 
-#define OPTSTRING "1aBbCcDdEeFfGgHhIiKkLlMmNnOoPpqRrSsTtUuVvx"
+#define OPTSTRING "01aBbCcDdEeFfGgHhIiKkLlMmNnOoPpqRrSsTtUuVvx"
 
 /* defaults should be the first element */
 enum display { DISPLAY_ONE_PER_LINE, DISPLAY_IN_COLUMNS, DISPLAY_IN_ROWS };
@@ -22,6 +27,12 @@ enum timestyle { TIME_TRADITIONAL, TIME_RELATIVE };
 enum sorttype { SORT_BY_NAME, SORT_BY_TIME, SORT_BY_SIZE, SORT_UNSORTED, SORT_BY_VERSION };
 enum tri { DEFAULT = -1, OFF = 0, ON = 1 };
 
+/* upper limit for --threads */
+#define MAXTHREADS 256
+
+/* default for --lookahead */
+#define LOOKAHEAD 65536
+
 /* all the command line options */
 /* defaults should usually be 0 */
 typedef struct options {
@@ -34,18 +45,30 @@ typedef struct options {
     bool directory : 1;             /* true = show directory name rather than contents */
     bool dirsonly : 1;              /* true = only list directories, not regular files */
     bool dirtotals : 1;             /* true = show directory size totals */
+    size_t dirbufsize;              /* bytes of directory entries to read per system call */
     enum display displaymode;       /* one-per-line, columns, rows, etc. */ 
     enum escape escape;             /*     how to handle non-printable characters */
+    const char *filesfrom;          /* file to read paths to list from, "-" = stdin, NULL = use arguments */
     enum flags flags;               /*     show file "flags" */
     enum tri followdirlinkargs : 2; /* ON = dereference links to dirs in args */
     bool group : 1;                 /* true = show the file's group */
+    Patterns *ignore;               /* names not to list or go into, NULL if none */
+    Patterns *include;              /* names of non-directories to list, NULL = all */
     bool inode : 1;                 /* true = show the inode number */
+    size_t limit;                   /* entries to list at most, 0 = no limit */
     bool linkcount : 1;             /* true = show number of hard links */
     bool longformat : 1;            /* true = long format */
+    size_t lookahead;               /* entries read before unsorted one-per-line output starts, 0 = all */
+    int maxdepth;                   /* with -R, deepest directories to list, 0 = arguments only, -1 = no limit */
+    size_t maxmemory;               /* bytes of entries to sort in memory per directory, 0 = no limit */
+    int mindepth;                   /* with -R, shallowest directories to list, 0 = arguments */
     bool modes : 1;                 /* true = show the file's modes, e.g. -rwxr-xr-x */
+    bool nullpaths : 1;             /* true = --files-from paths end with NUL, not newline */
     bool numeric : 1;               /* true = show uid and gid instead of username and groupname */
+    bool onefilesystem : 1;         /* true = with -R, don't list directories on other file systems */
     bool owner : 1;                 /* true = show the file's owner */
     bool perms : 1;                 /* true = show permissions for the current user, e.g. rwx */
+    size_t queuedepth;              /* directories listed ahead of the output, 0 = the default */
     bool recursive : 1;             /* true = after listing a directory, list its subdirectories recursively */
     bool reverse : 1;               /* true = sort oldest to newest (or smallest to largest with -S option) */
     bool showlink : 1;              /* true = show link -> target in name field (max. 1 link) */
@@ -53,16 +76,29 @@ typedef struct options {
     bool size : 1;                  /* true = show file size in blocks */
     enum sizestyle sizestyle;       /* how to display sizes */
     enum sorttype sorttype;         /* how to sort */
+    enum summarize summarize;       /* print totals per owner, etc. instead of entries, SUMMARIZE_NONE = entries */
     enum tri targetinfo : 2;        /* ON = field info is based on symlink target */
+    int threads;                    /* threads to fetch metadata with, 1 = no extra threads */
+    size_t top;                     /* list only the first N entries in sort order, with -R of the whole tree, 0 = all */
+    bool tree : 1;                  /* true = list subdirectories recursively, drawn as a tree */
+    bool treesize : 1;              /* true = show the blocks and entries under each file, like du -s */
     enum timestyle timestyle;       /* how to display times */
     enum timetype timetype;         /* which time to show (mtime, ctime, etc.) */
+    Predicate *where;               /* files (not directories gone into) to list, NULL = all */
 
     /* these are more like global state variables than options */
+    Top *best;                      /* with --top and -R, the first entries in the tree so far, else NULL */
     file_compare_function compare;  /* determines sort order */
+    bool fullpaths : 1;             /* true = show each file's path, not just its name */
     Map *groupnames;                /* cache of gid -> groupname for -g */
+    size_t listed;                  /* entries listed so far, for --limit */
     time_t now;                     /* current time - for determining date/time format */
     Colors *colors;                 /* the colors to use */
+    bool needstat : 1;              /* true = most files will need to be stat'ed */
+    Pool *pool;                     /* threads for fetching metadata, started when first needed */
     short screenwidth;              /* how wide the screen is, 0 if unknown */
+    unsigned int statfields;        /* metadata needed for fields and sorting, see setstatfields() */
+    Summary *summary;               /* with --summarize-by or --count, the totals so far, else NULL */
     const char *timeformat;         /* custom time format for -T */
     Map *usernames;                 /* cache of uid -> username for -o */
 } Options;
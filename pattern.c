@@ -0,0 +1,406 @@
+#define _POSIX_C_SOURCE 200809L /* for getline() */
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "pattern.h"
+
+/* longest pattern run as an NFA, with one bit per state in a uint64_t;
+ * longer ones are left to fnmatch() */
+#define MAXTOKENS 63
+
+enum tokenkind { TOKEN_CHAR, TOKEN_ANY, TOKEN_SET, TOKEN_STAR };
+
+/* one element of a glob: a character, "?", "[...]" or "*" */
+typedef struct token {
+    enum tokenkind kind;
+    unsigned char c;                /* for TOKEN_CHAR */
+    unsigned char set[32];          /* for TOKEN_SET, a bit for each byte */
+} Token;
+
+/* literal text to compare names against */
+typedef struct literal {
+    struct literal *next;
+    size_t len;
+    char text[];
+} Literal;
+
+/* a pattern that isn't just literal text and stars */
+typedef struct glob {
+    struct glob *next;
+    char *text;                     /* passed to fnmatch() if not compiled, else NULL */
+    int ntokens;
+    Token tokens[];                 /* state i is "tokens[i] is next to match" */
+} Glob;
+
+struct patterns {
+    Literal *exact[256];            /* "name", by first byte */
+    Literal *prefixes[256];         /* "name*", by first byte */
+    Literal *suffixes[256];         /* "*name", by last byte */
+    Literal *substrings;            /* "*name*", including "*" */
+    Glob *globs;                    /* everything else */
+};
+
+Patterns *newpatterns(void)
+{
+    Patterns *patterns = calloc(1, sizeof(*patterns));
+    if (!patterns) {
+        errorf("Out of memory\n");
+        return NULL;
+    }
+    return patterns;
+}
+
+static void freeliterals(Literal *literal)
+{
+    while (literal) {
+        Literal *next = literal->next;
+        free(literal);
+        literal = next;
+    }
+}
+
+void freepatterns(Patterns *patterns)
+{
+    if (!patterns) return;
+    for (int i = 0; i < 256; i++) {
+        freeliterals(patterns->exact[i]);
+        freeliterals(patterns->prefixes[i]);
+        freeliterals(patterns->suffixes[i]);
+    }
+    freeliterals(patterns->substrings);
+    Glob *glob = patterns->globs;
+    while (glob) {
+        Glob *next = glob->next;
+        free(glob->text);
+        free(glob);
+        glob = next;
+    }
+    free(patterns);
+}
+
+static void addtoset(unsigned char *set, unsigned char c)
+{
+    set[c / 8] |= 1 << (c % 8);
+}
+
+static bool inset(const unsigned char *set, unsigned char c)
+{
+    return set[c / 8] & (1 << (c % 8));
+}
+
+/**
+ * Parse the "[...]" at *pp into token, and move *pp past it.
+ *
+ * Returns false if there's no closing "]", so the "[" is just a character,
+ * and sets *unsupported for things fnmatch() has to handle, e.g. "[:alpha:]".
+ */
+static bool parseset(const char **pp, Token *token, bool *unsupported)
+{
+    const char *p = *pp + 1;
+    bool negate = *p == '!' || *p == '^';
+    if (negate) p++;
+    memset(token->set, 0, sizeof(token->set));
+    bool first = true;
+    while (*p && (first || *p != ']')) {
+        first = false;
+        if (p[0] == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+            *unsupported = true;
+        }
+        unsigned char lo = *p;
+        if (*p == '\\' && p[1]) {
+            lo = *++p;
+        }
+        p++;
+        unsigned char hi = lo;
+        if (p[0] == '-' && p[1] && p[1] != ']') {
+            p++;
+            if (*p == '\\' && p[1]) p++;
+            hi = *p++;
+        }
+        for (unsigned c = lo; c <= hi; c++) {
+            addtoset(token->set, c);
+        }
+    }
+    if (*p != ']') {
+        return false;
+    }
+    if (negate) {
+        for (int i = 0; i < sizeof(token->set); i++) {
+            token->set[i] = ~token->set[i];
+        }
+    }
+    token->kind = TOKEN_SET;
+    *pp = p + 1;
+    return true;
+}
+
+/**
+ * Split glob into tokens, which must have room for strlen(glob),
+ * with runs of "*" made into one.
+ *
+ * Returns the number of tokens.
+ */
+static int parseglob(const char *glob, Token *tokens, bool *unsupported)
+{
+    int n = 0;
+    const char *p = glob;
+    while (*p) {
+        Token *token = &tokens[n];
+        if (*p == '*') {
+            p++;
+            if (n > 0 && tokens[n-1].kind == TOKEN_STAR) {
+                continue;
+            }
+            token->kind = TOKEN_STAR;
+        } else if (*p == '?') {
+            p++;
+            token->kind = TOKEN_ANY;
+        } else if (*p == '[' && parseset(&p, token, unsupported)) {
+            /* p is past the set */
+        } else {
+            if (*p == '\\' && p[1]) {
+                p++;
+            }
+            token->kind = TOKEN_CHAR;
+            token->c = *p++;
+        }
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Add the literal characters in tokens[from] to tokens[to - 1]
+ * to the front of *plist.
+ */
+static bool addliteral(Literal **plist, const Token *tokens, int from, int to)
+{
+    size_t len = to - from;
+    Literal *literal = malloc(sizeof(*literal) + len + 1);
+    if (!literal) {
+        errorf("Out of memory\n");
+        return false;
+    }
+    for (int i = from; i < to; i++) {
+        literal->text[i - from] = tokens[i].c;
+    }
+    literal->text[len] = '\0';
+    literal->len = len;
+    literal->next = *plist;
+    *plist = literal;
+    return true;
+}
+
+/**
+ * Add tokens, or glob itself if they can't be run as an NFA.
+ */
+static bool addglob(Patterns *patterns, const char *text, const Token *tokens, int ntokens,
+                    bool compiled)
+{
+    Glob *glob = malloc(sizeof(*glob) + (compiled ? ntokens : 0) * sizeof(*tokens));
+    if (!glob) {
+        errorf("Out of memory\n");
+        return false;
+    }
+    glob->text = NULL;
+    glob->ntokens = 0;
+    if (compiled) {
+        memcpy(glob->tokens, tokens, ntokens * sizeof(*tokens));
+        glob->ntokens = ntokens;
+    } else if ((glob->text = strdup(text)) == NULL) {
+        errorf("Out of memory\n");
+        free(glob);
+        return false;
+    }
+    glob->next = patterns->globs;
+    patterns->globs = glob;
+    return true;
+}
+
+bool addpattern(Patterns *patterns, const char *glob)
+{
+    if (!patterns || !glob) {
+        errorf("patterns or glob is NULL\n");
+        return false;
+    }
+    size_t len = strlen(glob);
+    if (len == 0) {
+        /* no name is empty */
+        return true;
+    }
+    Token *tokens = malloc(len * sizeof(*tokens));
+    if (!tokens) {
+        errorf("Out of memory\n");
+        return false;
+    }
+    bool unsupported = false;
+    int n = parseglob(glob, tokens, &unsupported);
+
+    /* find the literal run, if that's all there is between the stars */
+    bool leadingstar = tokens[0].kind == TOKEN_STAR;
+    bool trailingstar = n > 1 && tokens[n-1].kind == TOKEN_STAR;
+    int from = leadingstar ? 1 : 0;
+    int to = trailingstar ? n - 1 : n;
+    bool literal = !unsupported;
+    for (int i = from; i < to && literal; i++) {
+        literal = tokens[i].kind == TOKEN_CHAR;
+    }
+
+    bool ok;
+    if (literal && leadingstar && (trailingstar || n == 1)) {
+        ok = addliteral(&patterns->substrings, tokens, from, to);
+    } else if (literal && leadingstar) {
+        ok = addliteral(&patterns->suffixes[tokens[to-1].c], tokens, from, to);
+    } else if (literal && trailingstar) {
+        ok = addliteral(&patterns->prefixes[tokens[0].c], tokens, from, to);
+    } else if (literal) {
+        ok = addliteral(&patterns->exact[tokens[0].c], tokens, from, to);
+    } else {
+        ok = addglob(patterns, glob, tokens, n, !unsupported && n <= MAXTOKENS);
+    }
+    free(tokens);
+    return ok;
+}
+
+bool readpatterns(Patterns *patterns, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    bool ok = true;
+    while (ok && (len = getline(&line, &size, file)) != -1) {
+        if (len > 0 && line[len-1] == '\n') {
+            line[--len] = '\0';
+        }
+        if (len == 0 || line[0] == '#') {
+            continue;
+        }
+        ok = addpattern(patterns, line);
+        if (!ok) {
+            errno = ENOMEM;
+        }
+    }
+    if (ok && ferror(file)) {
+        ok = false;
+    }
+    int saved = errno;
+    free(line);
+    fclose(file);
+    errno = saved;
+    return ok;
+}
+
+/**
+ * Add to states the ones reachable without matching a character,
+ * i.e. past each "*" that's reached, since it can match nothing.
+ */
+static uint64_t closure(const Glob *glob, uint64_t states)
+{
+    for (int i = 0; i < glob->ntokens; i++) {
+        if ((states & (1ULL << i)) && glob->tokens[i].kind == TOKEN_STAR) {
+            states |= 1ULL << (i + 1);
+        }
+    }
+    return states;
+}
+
+/**
+ * Run glob's NFA over name, all the states at once.
+ */
+static bool matchglob(const Glob *glob, const char *name)
+{
+    if (glob->text) {
+        return fnmatch(glob->text, name, FNM_PERIOD) == 0;
+    }
+    const char *p = name;
+    uint64_t states = 1;
+    if (*p == '.') {
+        /* only a "." at the start of the pattern matches a leading "." */
+        const Token *token = &glob->tokens[0];
+        if (glob->ntokens == 0 || token->kind != TOKEN_CHAR || token->c != '.') {
+            return false;
+        }
+        states = 2;
+        p++;
+    }
+    states = closure(glob, states);
+    for (; *p && states; p++) {
+        unsigned char c = *p;
+        uint64_t next = 0;
+        for (int i = 0; i < glob->ntokens; i++) {
+            if (!(states & (1ULL << i))) {
+                continue;
+            }
+            const Token *token = &glob->tokens[i];
+            switch (token->kind) {
+            case TOKEN_CHAR:
+                if (c == token->c) next |= 1ULL << (i + 1);
+                break;
+            case TOKEN_ANY:
+                next |= 1ULL << (i + 1);
+                break;
+            case TOKEN_SET:
+                if (inset(token->set, c)) next |= 1ULL << (i + 1);
+                break;
+            case TOKEN_STAR:
+                next |= 1ULL << i;
+                break;
+            }
+        }
+        states = closure(glob, next);
+    }
+    return states & (1ULL << glob->ntokens);
+}
+
+bool matchpatterns(Patterns *patterns, const char *name)
+{
+    if (!patterns || !name || !*name) {
+        return false;
+    }
+    size_t len = strlen(name);
+    unsigned char first = name[0];
+    unsigned char last = name[len-1];
+
+    for (Literal *literal = patterns->exact[first]; literal; literal = literal->next) {
+        if (literal->len == len && memcmp(literal->text, name, len) == 0) {
+            return true;
+        }
+    }
+    for (Literal *literal = patterns->prefixes[first]; literal; literal = literal->next) {
+        if (literal->len <= len && memcmp(literal->text, name, literal->len) == 0) {
+            return true;
+        }
+    }
+    /* a leading "*" doesn't match a leading "." */
+    if (first != '.') {
+        for (Literal *literal = patterns->suffixes[last]; literal; literal = literal->next) {
+            if (literal->len <= len &&
+                    memcmp(literal->text, name + len - literal->len, literal->len) == 0) {
+                return true;
+            }
+        }
+        for (Literal *literal = patterns->substrings; literal; literal = literal->next) {
+            if (strstr(name, literal->text)) {
+                return true;
+            }
+        }
+    }
+    for (Glob *glob = patterns->globs; glob; glob = glob->next) {
+        if (matchglob(glob, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,55 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stdbool.h>
+
+/*
+ * A set of shell glob patterns, e.g. "*.o", compiled for matching
+ * many file names against.
+ *
+ * Patterns are matched as by fnmatch() with FNM_PERIOD: "*", "?" and
+ * "[...]" don't match a leading ".", and "\" quotes the next character.
+ * Patterns that are plain names, prefixes ("name*"), suffixes ("*.o") or
+ * substrings ("*name*") go in tables indexed by their first or last byte,
+ * so most names are rejected after a byte or two.  Anything else is
+ * compiled into a small NFA that's run over the name in one pass.
+ */
+
+typedef struct patterns Patterns;
+
+/**
+ * Create an empty set of patterns, which matches nothing.
+ *
+ * Returns NULL on failure.
+ */
+Patterns *newpatterns(void);
+
+/**
+ * Free patterns and everything in it.
+ */
+void freepatterns(Patterns *patterns);
+
+/**
+ * Compile glob and add it to patterns.
+ *
+ * Returns false on failure.
+ */
+bool addpattern(Patterns *patterns, const char *glob);
+
+/**
+ * Add each line of the file at path to patterns, except empty lines
+ * and lines starting with "#".
+ *
+ * Returns false, with errno set, if the file can't be read.
+ */
+bool readpatterns(Patterns *patterns, const char *path);
+
+/**
+ * Return true if name matches any of patterns.
+ *
+ * Safe to call from several threads at once.
+ */
+bool matchpatterns(Patterns *patterns, const char *name);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
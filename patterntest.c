@@ -0,0 +1,96 @@
+#define _POSIX_C_SOURCE 200809L /* for mkstemp() */
+
+#include <assert.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "pattern.h"
+
+void test_matches_like_fnmatch(void);
+void test_matches_any_pattern(void);
+void test_read_patterns(void);
+
+int main(int argc, char **argv)
+{
+    myname = "patterntest";
+
+    test_matches_like_fnmatch();
+    test_matches_any_pattern();
+    test_read_patterns();
+    return 0;
+}
+
+static const char *globs[] = {
+    "core", "*.o", "*.tar.gz", "build*", ".git*", "*tmp*", "*",
+    "?", "a?c", "*.[ch]", "[!a-m]*", "[^.]*", "x*y*z", "*a*b",
+    "file[0-9][0-9]", "\\*", "a\\?c", "[]x]", "[a-]", "[", "a[b",
+    "*[[:digit:]]", ".*", "*.", "*~", "**.c", "?*.c",
+    "a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*b",
+};
+
+static const char *names[] = {
+    "core", "core.1", "a.o", ".o", "x.tar.gz", "tar.gz", "build", "builder",
+    ".git", ".gitignore", "git", "mytmpdir", "tmp", ".tmp", "a", ".", "..",
+    "abc", "a.c", "a.h", "a.cc", "zebra", ".hidden", "xyz", "x1y2z3", "xaab",
+    "file01", "file1", "*", "a?c", "]", "x", "-", "[", "a[b", "v2", "name.",
+    "backup~", "c", ".c", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab",
+};
+
+void test_matches_like_fnmatch(void)
+{
+    for (int i = 0; i < sizeof(globs) / sizeof(*globs); i++) {
+        Patterns *patterns = newpatterns();
+        assert(patterns);
+        assert(addpattern(patterns, globs[i]));
+        for (int j = 0; j < sizeof(names) / sizeof(*names); j++) {
+            bool expected = fnmatch(globs[i], names[j], FNM_PERIOD) == 0;
+            if (matchpatterns(patterns, names[j]) != expected) {
+                errorf("'%s' vs '%s': expected %d\n", globs[i], names[j], expected);
+                assert(0);
+            }
+        }
+        freepatterns(patterns);
+    }
+}
+
+void test_matches_any_pattern(void)
+{
+    Patterns *patterns = newpatterns();
+    assert(patterns);
+    assert(!matchpatterns(patterns, "anything"));
+    assert(addpattern(patterns, "*.o"));
+    assert(addpattern(patterns, "core"));
+    assert(addpattern(patterns, "x*y*z"));
+    assert(matchpatterns(patterns, "a.o"));
+    assert(matchpatterns(patterns, "core"));
+    assert(matchpatterns(patterns, "xyz"));
+    assert(!matchpatterns(patterns, "a.c"));
+    freepatterns(patterns);
+}
+
+void test_read_patterns(void)
+{
+    char path[] = "/tmp/patterntest.XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    FILE *file = fdopen(fd, "w");
+    assert(file);
+    fputs("# comment\n\n*.o\ncore", file);
+    fclose(file);
+
+    Patterns *patterns = newpatterns();
+    assert(patterns);
+    assert(readpatterns(patterns, path));
+    assert(matchpatterns(patterns, "a.o"));
+    assert(matchpatterns(patterns, "core"));
+    assert(!matchpatterns(patterns, "# comment"));
+    unlink(path);
+    assert(!readpatterns(patterns, path));
+    freepatterns(patterns);
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,171 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "list.h"
+#include "logging.h"
+#include "pool.h"
+
+/* items handed to a thread at a time, so the lock isn't taken per item */
+#define CHUNKSIZE 16
+
+struct pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;            /* signalled when a walk starts, or to stop */
+    pthread_cond_t idle;            /* signalled when the last busy thread finishes */
+    pthread_t *threads;
+    int nthreads;                   /* started threads, not counting the caller */
+
+    /* the current walk, all protected by lock */
+    List *list;
+    walker_context_func func;
+    void *context;
+    unsigned next;                  /* index of the next item to hand out */
+    unsigned long generation;       /* incremented for each walk */
+    int nbusy;                      /* threads working on the walk */
+    bool stopping;
+};
+
+/**
+ * Do chunks of the current walk until there are none left.
+ *
+ * The caller must be counted in pool->nbusy,
+ * otherwise the walk could finish and its list be freed under us.
+ */
+static void runwalk(Pool *pool)
+{
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        List *list = pool->list;
+        walker_context_func func = pool->func;
+        void *context = pool->context;
+        unsigned start = pool->next;
+        unsigned end = list ? length(list) : 0;
+        if (start < end) {
+            if (end - start > CHUNKSIZE) {
+                end = start + CHUNKSIZE;
+            }
+            pool->next = end;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        if (start >= end) {
+            return;
+        }
+        for (unsigned i = start; i < end; i++) {
+            func(getitem(list, i), context);
+        }
+    }
+}
+
+static void *worker(void *arg)
+{
+    Pool *pool = arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stopping && pool->generation == seen) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (pool->stopping) {
+            break;
+        }
+        seen = pool->generation;
+        pool->nbusy++;
+        pthread_mutex_unlock(&pool->lock);
+
+        runwalk(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->nbusy--;
+        if (pool->nbusy == 0) {
+            pthread_cond_signal(&pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+Pool *newpool(int nthreads)
+{
+    Pool *pool = malloc(sizeof(*pool));
+    if (!pool) {
+        errorf("Out of memory\n");
+        return NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    pool->threads = malloc(nthreads * sizeof(*pool->threads));
+    if (!pool->threads) {
+        errorf("Out of memory\n");
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (int i = 0; i < nthreads - 1; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0) {
+            /* not fatal, make do with what we have */
+            errorf("Cannot start thread %d\n", i + 1);
+            break;
+        }
+        pool->nthreads++;
+    }
+    return pool;
+}
+
+void freepool(Pool *pool)
+{
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+void poolwalk(Pool *pool, List *list, walker_context_func func, void *context)
+{
+    if (!pool || !list || !func) {
+        errorf("pool, list, or func is NULL\n");
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->list = list;
+    pool->func = func;
+    pool->context = context;
+    pool->next = 0;
+    pool->generation++;
+    pool->nbusy++;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    runwalk(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->nbusy--;
+    while (pool->nbusy > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    /* so that a late thread doesn't look at a list that's gone */
+    pool->list = NULL;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
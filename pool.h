@@ -0,0 +1,33 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "list.h"
+
+typedef struct pool Pool;
+
+/**
+ * Create a pool of threads to share work between.
+ *
+ * nthreads includes the thread that will call poolwalk(),
+ * so nthreads - 1 new threads are started.
+ *
+ * Returns NULL on failure.
+ */
+Pool *newpool(int nthreads);
+
+/**
+ * Stop the pool's threads and free it.
+ */
+void freepool(Pool *pool);
+
+/**
+ * Call func(item, context) for every item in list, spread over the pool's
+ * threads, including the calling thread.
+ *
+ * Items are handed out in list order, but may finish in any order.
+ * Returns once all the calls have finished.
+ */
+void poolwalk(Pool *pool, List *list, walker_context_func func, void *context);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,83 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "list.h"
+#include "logging.h"
+#include "pool.h"
+
+void test_poolwalk_visits_every_item_once(void);
+void test_poolwalk_repeatedly(void);
+void test_poolwalk_single_thread(void);
+
+int main(int argc, const char *argv[])
+{
+    myname = "pooltest";
+
+    test_poolwalk_visits_every_item_once();
+    test_poolwalk_repeatedly();
+    test_poolwalk_single_thread();
+    return 0;
+}
+
+static void increment(void *item, void *context)
+{
+    (*(int *)item)++;
+}
+
+static List *newcounters(int n)
+{
+    List *list = newlist();
+    assert(list);
+    for (int i = 0; i < n; i++) {
+        int *counter = calloc(1, sizeof(*counter));
+        assert(counter);
+        append(counter, list);
+    }
+    return list;
+}
+
+static void checkcounters(List *list, int expected)
+{
+    for (unsigned i = 0; i < length(list); i++) {
+        assert(*(int *)getitem(list, i) == expected);
+    }
+}
+
+void test_poolwalk_visits_every_item_once(void)
+{
+    Pool *pool = newpool(4);
+    assert(pool);
+    List *list = newcounters(1001);
+    poolwalk(pool, list, increment, NULL);
+    checkcounters(list, 1);
+    freelist(list, free);
+    freepool(pool);
+}
+
+void test_poolwalk_repeatedly(void)
+{
+    Pool *pool = newpool(3);
+    assert(pool);
+    for (int n = 0; n < 100; n++) {
+        List *list = newcounters(n);
+        poolwalk(pool, list, increment, NULL);
+        poolwalk(pool, list, increment, NULL);
+        checkcounters(list, 2);
+        freelist(list, free);
+    }
+    freepool(pool);
+}
+
+void test_poolwalk_single_thread(void)
+{
+    Pool *pool = newpool(1);
+    assert(pool);
+    List *list = newcounters(50);
+    poolwalk(pool, list, increment, NULL);
+    checkcounters(list, 1);
+    freelist(list, free);
+    freepool(pool);
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
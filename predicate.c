@@ -0,0 +1,513 @@
+#define _XOPEN_SOURCE 700   /* for strndup() */
+#define _DEFAULT_SOURCE     /* for DT_* on glibc */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <dirent.h>         /* for DT_* */
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "file.h"
+#include "logging.h"
+#include "pattern.h"
+#include "predicate.h"
+
+enum nodekind { NODE_AND, NODE_OR, NODE_NOT, NODE_TEST };
+
+enum field {
+    FIELD_NAME, FIELD_TYPE, FIELD_SIZE, FIELD_LINKS, FIELD_INODE,
+    FIELD_UID, FIELD_GID, FIELD_MTIME, FIELD_ATIME, FIELD_CTIME, FIELD_BTIME,
+};
+
+enum op { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE };
+
+/* how a field's value is written */
+enum valuekind { VALUE_GLOB, VALUE_TYPE, VALUE_SIZE, VALUE_NUMBER, VALUE_AGE };
+
+struct predicate {
+    enum nodekind kind;
+    struct predicate *left;         /* for NODE_AND, NODE_OR and NODE_NOT */
+    struct predicate *right;        /* for NODE_AND and NODE_OR */
+    enum field field;               /* for NODE_TEST... */
+    enum op op;
+    long long value;                /* number, age in seconds, or S_IF* type */
+    Patterns *name;                 /* for FIELD_NAME */
+};
+
+static const struct fieldinfo {
+    const char *name;
+    enum field field;
+    enum valuekind kind;
+    unsigned int statfield;         /* enum statfield value needed, 0 = none */
+} fieldinfos[] = {
+    { "name",  FIELD_NAME,  VALUE_GLOB,   0           },
+    { "type",  FIELD_TYPE,  VALUE_TYPE,   0           },
+    { "size",  FIELD_SIZE,  VALUE_SIZE,   STAT_SIZE   },
+    { "links", FIELD_LINKS, VALUE_NUMBER, STAT_NLINK  },
+    { "inode", FIELD_INODE, VALUE_NUMBER, STAT_INO    },
+    { "uid",   FIELD_UID,   VALUE_NUMBER, STAT_UID    },
+    { "gid",   FIELD_GID,   VALUE_NUMBER, STAT_GID    },
+    { "mtime", FIELD_MTIME, VALUE_AGE,    STAT_MTIME  },
+    { "atime", FIELD_ATIME, VALUE_AGE,    STAT_ATIME  },
+    { "ctime", FIELD_CTIME, VALUE_AGE,    STAT_CTIME  },
+    { "btime", FIELD_BTIME, VALUE_AGE,    STAT_BTIME  },
+};
+#define NFIELDS (sizeof(fieldinfos) / sizeof(*fieldinfos))
+
+/* type letters, as for find -type */
+static const struct typeinfo {
+    char letter;
+    mode_t type;
+} typeinfos[] = {
+    { 'f', S_IFREG  },
+    { 'd', S_IFDIR  },
+    { 'l', S_IFLNK  },
+    { 'p', S_IFIFO  },
+    { 's', S_IFSOCK },
+    { 'b', S_IFBLK  },
+    { 'c', S_IFCHR  },
+};
+#define NTYPES (sizeof(typeinfos) / sizeof(*typeinfos))
+
+/* what's known about the file being tested */
+typedef struct subject {
+    const char *name;
+    mode_t type;                    /* S_IF* value, 0 = not known yet */
+    ino_t inode;                    /* 0 = not known yet */
+    File *file;                     /* NULL = nothing else is known */
+    time_t now;
+} Subject;
+
+typedef struct parser {
+    const char *p;                  /* the rest of the text */
+    const char *error;              /* set on failure */
+    const char *where;
+} Parser;
+
+void freepredicate(Predicate *predicate)
+{
+    if (!predicate) return;
+    freepredicate(predicate->left);
+    freepredicate(predicate->right);
+    freepatterns(predicate->name);
+    free(predicate);
+}
+
+static Predicate *newnode(enum nodekind kind, Predicate *left, Predicate *right)
+{
+    Predicate *node = calloc(1, sizeof(*node));
+    if (!node) {
+        errorf("Out of memory\n");
+        freepredicate(left);
+        freepredicate(right);
+        return NULL;
+    }
+    node->kind = kind;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+static Predicate *fail(Parser *parser, const char *error)
+{
+    if (!parser->error) {
+        parser->error = error;
+        parser->where = parser->p;
+    }
+    return NULL;
+}
+
+static void skipspace(Parser *parser)
+{
+    while (isspace((unsigned char)*parser->p)) {
+        parser->p++;
+    }
+}
+
+/**
+ * Move past token if it's next, and return true if it was.
+ */
+static bool accept(Parser *parser, const char *token)
+{
+    skipspace(parser);
+    size_t len = strlen(token);
+    if (strncmp(parser->p, token, len) == 0) {
+        parser->p += len;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Return the next value, quoted or not, as a new string.
+ */
+static char *parsevalue(Parser *parser)
+{
+    skipspace(parser);
+    const char *start = parser->p;
+    size_t len;
+    if (*start == '"' || *start == '\'') {
+        const char *end = strchr(start + 1, *start);
+        if (!end) {
+            fail(parser, "unterminated quote");
+            return NULL;
+        }
+        start++;
+        len = end - start;
+        parser->p = end + 1;
+    } else {
+        len = strcspn(start, " \t\n()&|!<>=");
+        parser->p += len;
+    }
+    if (len == 0 && start == parser->p) {
+        fail(parser, "expected a value");
+        return NULL;
+    }
+    char *value = strndup(start, len);
+    if (!value) {
+        fail(parser, "out of memory");
+    }
+    return value;
+}
+
+/**
+ * Convert a number with an optional suffix from units, e.g. "KMGT",
+ * each multiplying the one before by scales[i], or with no suffix by
+ * scale, into *pnumber.
+ *
+ * Returns false if it isn't one, or is too big for a long long.
+ */
+static bool parsenumber(const char *s, const char *units, const long long *scales,
+                        long long scale, long long *pnumber)
+{
+    char *end;
+    errno = 0;
+    long long number = strtoll(s, &end, 10);
+    if (errno != 0 || end == s || number < 0) {
+        return false;
+    }
+    if (*end) {
+        const char *unit = strchr(units, tolower((unsigned char)*end));
+        if (!unit || end[1]) {
+            return false;
+        }
+        scale = scales[unit - units];
+    }
+    if (number > LLONG_MAX / scale) {
+        return false;
+    }
+    *pnumber = number * scale;
+    return true;
+}
+
+static const long long sizescales[] = {
+    1024LL, 1024LL * 1024, 1024LL * 1024 * 1024, 1024LL * 1024 * 1024 * 1024,
+};
+static const long long agescales[] = {
+    1, 60, 60 * 60, 24 * 60 * 60, 7 * 24 * 60 * 60, 365 * 24 * 60 * 60,
+};
+
+/**
+ * Parse a comparison, e.g. "size > 1G".
+ */
+static Predicate *parsetest(Parser *parser)
+{
+    skipspace(parser);
+    const char *start = parser->p;
+    size_t len = 0;
+    while (isalpha((unsigned char)start[len])) {
+        len++;
+    }
+    const struct fieldinfo *info = NULL;
+    for (size_t i = 0; i < NFIELDS && !info; i++) {
+        if (strlen(fieldinfos[i].name) == len && strncmp(fieldinfos[i].name, start, len) == 0) {
+            info = &fieldinfos[i];
+        }
+    }
+    if (!info) {
+        return fail(parser, "unknown field");
+    }
+    parser->p += len;
+
+    skipspace(parser);
+    const char *opstart = parser->p;
+    enum op op;
+    if (accept(parser, "==") || accept(parser, "=")) {
+        op = OP_EQ;
+    } else if (accept(parser, "!=")) {
+        op = OP_NE;
+    } else if (accept(parser, "<=")) {
+        op = OP_LE;
+    } else if (accept(parser, ">=")) {
+        op = OP_GE;
+    } else if (accept(parser, "<")) {
+        op = OP_LT;
+    } else if (accept(parser, ">")) {
+        op = OP_GT;
+    } else {
+        return fail(parser, "expected a comparison");
+    }
+    if ((info->kind == VALUE_GLOB || info->kind == VALUE_TYPE) && op != OP_EQ && op != OP_NE) {
+        parser->p = opstart;
+        return fail(parser, "only == and != compare names and types");
+    }
+
+    skipspace(parser);
+    const char *valuestart = parser->p;
+    char *value = parsevalue(parser);
+    if (!value) {
+        return NULL;
+    }
+    Predicate *node = newnode(NODE_TEST, NULL, NULL);
+    if (!node) {
+        free(value);
+        return fail(parser, "out of memory");
+    }
+    node->field = info->field;
+    node->op = op;
+    bool ok = true;
+    switch (info->kind) {
+    case VALUE_GLOB:
+        node->name = newpatterns();
+        ok = node->name && addpattern(node->name, value);
+        break;
+    case VALUE_TYPE:
+        ok = false;
+        for (size_t i = 0; i < NTYPES && !ok; i++) {
+            if (value[0] == typeinfos[i].letter && value[1] == '\0') {
+                node->value = typeinfos[i].type;
+                ok = true;
+            }
+        }
+        break;
+    case VALUE_SIZE:
+        ok = parsenumber(value, "kmgt", sizescales, 1, &node->value);
+        break;
+    case VALUE_NUMBER:
+        ok = parsenumber(value, "", NULL, 1, &node->value);
+        break;
+    case VALUE_AGE:
+        /* days if there's no unit, as for find -mtime */
+        ok = parsenumber(value, "smhdwy", agescales, agescales[3], &node->value);
+        break;
+    }
+    free(value);
+    if (!ok) {
+        freepredicate(node);
+        parser->p = valuestart;
+        return fail(parser, "invalid value");
+    }
+    return node;
+}
+
+static Predicate *parseor(Parser *parser);
+
+static Predicate *parsenot(Parser *parser)
+{
+    skipspace(parser);
+    if (parser->p[0] == '!' && parser->p[1] != '=') {
+        parser->p++;
+        Predicate *operand = parsenot(parser);
+        return operand ? newnode(NODE_NOT, operand, NULL) : NULL;
+    }
+    if (accept(parser, "(")) {
+        Predicate *inner = parseor(parser);
+        if (inner && !accept(parser, ")")) {
+            freepredicate(inner);
+            return fail(parser, "expected )");
+        }
+        return inner;
+    }
+    return parsetest(parser);
+}
+
+static Predicate *parseand(Parser *parser)
+{
+    Predicate *left = parsenot(parser);
+    while (left && accept(parser, "&&")) {
+        Predicate *right = parsenot(parser);
+        if (!right) {
+            freepredicate(left);
+            return NULL;
+        }
+        left = newnode(NODE_AND, left, right);
+    }
+    return left;
+}
+
+static Predicate *parseor(Parser *parser)
+{
+    Predicate *left = parseand(parser);
+    while (left && accept(parser, "||")) {
+        Predicate *right = parseand(parser);
+        if (!right) {
+            freepredicate(left);
+            return NULL;
+        }
+        left = newnode(NODE_OR, left, right);
+    }
+    return left;
+}
+
+Predicate *parsepredicate(const char *text, const char **perror, const char **pwhere)
+{
+    Parser parser = { text, NULL, NULL };
+    Predicate *predicate = parseor(&parser);
+    skipspace(&parser);
+    if (predicate && *parser.p) {
+        freepredicate(predicate);
+        predicate = fail(&parser, "unexpected text");
+    }
+    if (!predicate) {
+        *perror = parser.error ? parser.error : "out of memory";
+        *pwhere = parser.where ? parser.where : text;
+    }
+    return predicate;
+}
+
+unsigned int getpredicatefields(Predicate *predicate)
+{
+    if (!predicate) {
+        return 0;
+    }
+    if (predicate->kind != NODE_TEST) {
+        return getpredicatefields(predicate->left) | getpredicatefields(predicate->right);
+    }
+    for (size_t i = 0; i < NFIELDS; i++) {
+        if (fieldinfos[i].field == predicate->field) {
+            return fieldinfos[i].statfield;
+        }
+    }
+    return 0;
+}
+
+static bool compare(enum op op, long long a, long long b)
+{
+    switch (op) {
+    case OP_EQ: return a == b;
+    case OP_NE: return a != b;
+    case OP_LT: return a < b;
+    case OP_LE: return a <= b;
+    case OP_GT: return a > b;
+    case OP_GE: return a >= b;
+    }
+    return false;
+}
+
+/**
+ * Return the S_IF* type of file, 0 if it can't be found out.
+ */
+static mode_t gettype(File *file)
+{
+    if (!hastype(file)) return 0;
+    if (isdir(file))       return S_IFDIR;
+    if (islink(file))      return S_IFLNK;
+    if (isfifo(file))      return S_IFIFO;
+    if (issock(file))      return S_IFSOCK;
+    if (isblockdev(file))  return S_IFBLK;
+    if (ischardev(file))   return S_IFCHR;
+    return S_IFREG;
+}
+
+static enum match test(Predicate *node, Subject *subject)
+{
+    bool equal = node->op == OP_EQ;
+    if (node->field == FIELD_NAME) {
+        return matchpatterns(node->name, subject->name) == equal;
+    }
+    if (node->field == FIELD_TYPE) {
+        if (subject->type == 0 && subject->file) {
+            subject->type = gettype(subject->file);
+        }
+        if (subject->type == 0) {
+            return subject->file ? MATCH_NO : MATCH_UNKNOWN;
+        }
+        return (subject->type == node->value) == equal;
+    }
+    if (node->field == FIELD_INODE && subject->inode != 0) {
+        return compare(node->op, subject->inode, node->value);
+    }
+
+    File *file = subject->file;
+    if (!file) {
+        return MATCH_UNKNOWN;
+    }
+    if (!isstat(file)) {
+        return MATCH_NO;
+    }
+    long long value = 0;
+    switch (node->field) {
+    case FIELD_SIZE:  value = getsize(file); break;
+    case FIELD_LINKS: value = getlinkcount(file); break;
+    case FIELD_INODE: value = getinode(file); break;
+    case FIELD_UID:   value = getownernum(file); break;
+    case FIELD_GID:   value = getgroupnum(file); break;
+    case FIELD_MTIME: value = subject->now - getmtime(file); break;
+    case FIELD_ATIME: value = subject->now - getatime(file); break;
+    case FIELD_CTIME: value = subject->now - getctime(file); break;
+    case FIELD_BTIME: value = subject->now - getbtime(file); break;
+    default:
+        errorf("Unknown field %d\n", node->field);
+        return MATCH_NO;
+    }
+    return compare(node->op, value, node->value);
+}
+
+/**
+ * Evaluate node with what's known about subject,
+ * with MATCH_UNKNOWN for anything that depends on what isn't.
+ */
+static enum match evaluate(Predicate *node, Subject *subject)
+{
+    enum match left, right;
+    switch (node->kind) {
+    case NODE_AND:
+        left = evaluate(node->left, subject);
+        if (left == MATCH_NO) return MATCH_NO;
+        right = evaluate(node->right, subject);
+        if (right == MATCH_NO) return MATCH_NO;
+        return left == MATCH_YES && right == MATCH_YES ? MATCH_YES : MATCH_UNKNOWN;
+    case NODE_OR:
+        left = evaluate(node->left, subject);
+        if (left == MATCH_YES) return MATCH_YES;
+        right = evaluate(node->right, subject);
+        if (right == MATCH_YES) return MATCH_YES;
+        return left == MATCH_NO && right == MATCH_NO ? MATCH_NO : MATCH_UNKNOWN;
+    case NODE_NOT:
+        left = evaluate(node->left, subject);
+        return left == MATCH_UNKNOWN ? MATCH_UNKNOWN : !left;
+    case NODE_TEST:
+        return test(node, subject);
+    }
+    return MATCH_UNKNOWN;
+}
+
+enum match matchentry(Predicate *predicate, const char *name, unsigned char type,
+                      ino_t inode)
+{
+    /* a mount point's inode isn't readdir()'s, so directories' are stat'ed */
+    bool dir = type == DT_DIR || type == DT_UNKNOWN;
+    Subject subject = { name, 0, dir ? 0 : inode, NULL, 0 };
+    switch (type) {
+    case DT_REG:  subject.type = S_IFREG;  break;
+    case DT_DIR:  subject.type = S_IFDIR;  break;
+    case DT_LNK:  subject.type = S_IFLNK;  break;
+    case DT_FIFO: subject.type = S_IFIFO;  break;
+    case DT_SOCK: subject.type = S_IFSOCK; break;
+    case DT_BLK:  subject.type = S_IFBLK;  break;
+    case DT_CHR:  subject.type = S_IFCHR;  break;
+    default: break;
+    }
+    return evaluate(predicate, &subject);
+}
+
+bool matchfile(Predicate *predicate, File *file, time_t now)
+{
+    Subject subject = { getname(file), 0, 0, file, now };
+    return evaluate(predicate, &subject) == MATCH_YES;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
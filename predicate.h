@@ -0,0 +1,68 @@
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "file.h"
+
+/*
+ * A compiled --where expression, e.g.
+ *
+ *     size > 1G && mtime < 30d && type == f
+ *
+ * Tests compare a field with a value: name (a glob, == and != only),
+ * type (f, d, l, p, s, b or c, == and != only), size (bytes, with an
+ * optional K, M, G or T suffix), links, inode, uid, gid, and the ages
+ * mtime, atime, ctime and btime (days, or with an s, m, h, d, w or y
+ * suffix).  Tests can be combined with &&, || and !, and grouped with
+ * parentheses.
+ *
+ * Tests are done with as little as possible: the name, type and inode
+ * number from the directory entry first, before anything is allocated,
+ * and the file's metadata only if that doesn't decide it.
+ */
+
+typedef struct predicate Predicate;
+
+/* results of matchentry() */
+enum match { MATCH_NO = 0, MATCH_YES = 1, MATCH_UNKNOWN = -1 };
+
+/**
+ * Compile text into a predicate.
+ *
+ * Returns NULL on failure, with *perror set to a static description
+ * of the problem and *pwhere to where in text it was found.
+ */
+Predicate *parsepredicate(const char *text, const char **perror, const char **pwhere);
+
+/**
+ * Free predicate and everything in it.
+ */
+void freepredicate(Predicate *predicate);
+
+/**
+ * Return the metadata that predicate needs, a mask of enum statfield values,
+ * for setstatfields().
+ */
+unsigned int getpredicatefields(Predicate *predicate);
+
+/**
+ * Test a directory entry with only what readdir() tells us.
+ *
+ * type is a DT_* value, or DT_UNKNOWN, and inode is 0 if unknown.
+ * Returns MATCH_UNKNOWN if it depends on anything else.
+ */
+enum match matchentry(Predicate *predicate, const char *name, unsigned char type,
+                      ino_t inode);
+
+/**
+ * Test file, stat'ing it if need be.
+ *
+ * Ages are worked out relative to now.
+ */
+bool matchfile(Predicate *predicate, File *file, time_t now);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
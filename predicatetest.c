@@ -0,0 +1,164 @@
+#define _DEFAULT_SOURCE     /* for DT_* on glibc */
+
+#include <sys/stat.h>
+#include <assert.h>
+#include <dirent.h>         /* for DT_* */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "file.h"
+#include "logging.h"
+#include "predicate.h"
+
+void test_parse_errors(void);
+void test_needed_fields(void);
+void test_match_entry(void);
+void test_match_file(void);
+
+int main(int argc, char **argv)
+{
+    myname = "predicatetest";
+
+    test_parse_errors();
+    test_needed_fields();
+    test_match_entry();
+    test_match_file();
+    return 0;
+}
+
+static Predicate *parse(const char *text)
+{
+    const char *error, *where;
+    Predicate *predicate = parsepredicate(text, &error, &where);
+    if (!predicate) {
+        errorf("'%s': %s at '%s'\n", text, error, where);
+        assert(0);
+    }
+    return predicate;
+}
+
+void test_parse_errors(void)
+{
+    static const struct {
+        const char *text;
+        const char *where;
+    } bad[] = {
+        { "",                   ""      },
+        { "colour == red",      "colour == red" },
+        { "size",               ""      },
+        { "size > big",         "big"   },
+        { "size > 1X",          "1X"    },
+        { "name < foo",         "< foo" },
+        { "type == x",          "x"     },
+        { "(size > 1",          ""      },
+        { "size > 1 size < 2",  "size < 2" },
+        { "name == 'foo",       "'foo"  },
+        { "size > 1 &&",        ""      },
+        { "size > 99999999999999T", "99999999999999T" },
+        { "mtime > 999999999999999", "999999999999999" },
+    };
+    for (int i = 0; i < sizeof(bad) / sizeof(*bad); i++) {
+        const char *error = NULL, *where = NULL;
+        Predicate *predicate = parsepredicate(bad[i].text, &error, &where);
+        assert(predicate == NULL);
+        assert(error != NULL);
+        if (strcmp(where, bad[i].where) != 0) {
+            errorf("'%s': error at '%s', expected '%s'\n", bad[i].text, where, bad[i].where);
+            assert(0);
+        }
+    }
+}
+
+void test_needed_fields(void)
+{
+    Predicate *predicate = parse("name == '*.c' || type != d");
+    assert(getpredicatefields(predicate) == 0);
+    freepredicate(predicate);
+
+    predicate = parse("size > 1G && mtime < 30d && type == f");
+    assert(getpredicatefields(predicate) == (STAT_SIZE | STAT_MTIME));
+    freepredicate(predicate);
+
+    predicate = parse("!(uid == 0 || links > 1)");
+    assert(getpredicatefields(predicate) == (STAT_UID | STAT_NLINK));
+    freepredicate(predicate);
+}
+
+void test_match_entry(void)
+{
+    Predicate *predicate = parse("name == *.c && type == f");
+    assert(matchentry(predicate, "l.c", DT_REG, 1) == MATCH_YES);
+    assert(matchentry(predicate, "l.h", DT_REG, 1) == MATCH_NO);
+    assert(matchentry(predicate, "src.c", DT_DIR, 1) == MATCH_NO);
+    /* without d_type, it depends on the stat */
+    assert(matchentry(predicate, "l.c", DT_UNKNOWN, 1) == MATCH_UNKNOWN);
+    assert(matchentry(predicate, "l.h", DT_UNKNOWN, 1) == MATCH_NO);
+    freepredicate(predicate);
+
+    /* one side decides it either way */
+    predicate = parse("type == d || size > 1M");
+    assert(matchentry(predicate, "dir", DT_DIR, 1) == MATCH_YES);
+    assert(matchentry(predicate, "file", DT_REG, 1) == MATCH_UNKNOWN);
+    freepredicate(predicate);
+    predicate = parse("type == d && size > 1M");
+    assert(matchentry(predicate, "file", DT_REG, 1) == MATCH_NO);
+    freepredicate(predicate);
+
+    predicate = parse("!(name == a* || name == b*)");
+    assert(matchentry(predicate, "apple", DT_REG, 1) == MATCH_NO);
+    assert(matchentry(predicate, "cherry", DT_REG, 1) == MATCH_YES);
+    freepredicate(predicate);
+
+    predicate = parse("inode == 42");
+    assert(matchentry(predicate, "x", DT_REG, 42) == MATCH_YES);
+    assert(matchentry(predicate, "x", DT_REG, 43) == MATCH_NO);
+    assert(matchentry(predicate, "x", DT_REG, 0) == MATCH_UNKNOWN);
+    freepredicate(predicate);
+}
+
+void test_match_file(void)
+{
+    struct stat st;
+    assert(stat("GNUmakefile", &st) == 0);
+    File *file = newfile(".", "GNUmakefile");
+    assert(file);
+    time_t now = time(NULL);
+    char text[256];
+
+    snprintf(text, sizeof(text), "size == %ld && type == f && name == GNU*",
+             (long)st.st_size);
+    Predicate *predicate = parse(text);
+    assert(matchfile(predicate, file, now));
+    freepredicate(predicate);
+
+    snprintf(text, sizeof(text), "size > %ld || inode != %lu",
+             (long)st.st_size, (unsigned long)st.st_ino);
+    predicate = parse(text);
+    assert(!matchfile(predicate, file, now));
+    freepredicate(predicate);
+
+    /* ages are from now, so an hour from now it's at least an hour old */
+    predicate = parse("mtime >= 1h");
+    assert(!matchfile(predicate, file, st.st_mtime));
+    assert(matchfile(predicate, file, st.st_mtime + 3600));
+    freepredicate(predicate);
+    predicate = parse("mtime < 2");
+    assert(matchfile(predicate, file, st.st_mtime + 24 * 60 * 60));
+    assert(!matchfile(predicate, file, st.st_mtime + 2 * 24 * 60 * 60));
+    freepredicate(predicate);
+
+    predicate = parse("size <= 1K || size >= 1K");
+    assert(matchfile(predicate, file, now));
+    freepredicate(predicate);
+    freefile(file);
+
+    File *missing = newfile(".", "no such file");
+    assert(missing);
+    predicate = parse("size >= 0");
+    assert(!matchfile(predicate, missing, now));
+    freepredicate(predicate);
+    freefile(missing);
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,213 @@
+#define _GNU_SOURCE             /* for struct statx on glibc */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/stat.h>         /* for struct statx */
+#endif
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "file.h"
+#include "list.h"
+#include "logging.h"
+#include "options.h"
+#include "pool.h"
+#include "prefetch.h"
+#include "treesize.h"
+#include "uring.h"
+
+/* below this many files, a batch isn't worth setting up */
+#define MINBATCH 8
+/* below this many files, waking up other threads isn't worth it */
+#define MINPARALLEL 64
+
+/* options->pool does one walk at a time, and directories may be
+ * listed on several threads, so the others just don't prefetch */
+static pthread_mutex_t poollock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef HAVE_IO_URING
+/**
+ * statx() all of files that still need it using io_uring.
+ *
+ * Anything left undone (e.g. io_uring isn't available)
+ * is stat'ed one at a time later.
+ */
+static void prefetchuring(List *files, unsigned int what)
+{
+    unsigned nfiles = length(files);
+    StatxCall *calls = malloc(nfiles * sizeof(*calls));
+    File **callfiles = malloc(nfiles * sizeof(*callfiles));
+    struct statx *bufs = malloc(nfiles * sizeof(*bufs));
+    if (!calls || !callfiles || !bufs) {
+        /* not fatal, this is only an optimization */
+        free(calls);
+        free(callfiles);
+        free(bufs);
+        return;
+    }
+
+    size_t ncalls = 0;
+    for (unsigned i = 0; i < nfiles; i++) {
+        File *file = getitem(files, i);
+        StatxCall *call = &calls[ncalls];
+        if (!getstatxargs(file, what, &call->dirfd, &call->path, &call->flags, &call->mask)) {
+            continue;
+        }
+        call->buf = &bufs[ncalls];
+        call->done = false;
+        call->error = 0;
+        callfiles[ncalls] = file;
+        ncalls++;
+    }
+
+    if (ncalls >= MINBATCH) {
+        uringstatx(calls, ncalls);
+        for (size_t i = 0; i < ncalls; i++) {
+            /* EINVAL means the kernel doesn't know IORING_OP_STATX,
+             * so leave those for the synchronous path */
+            if (calls[i].done && calls[i].error != EINVAL) {
+                setstatx(callfiles[i], calls[i].buf, calls[i].error);
+            }
+        }
+    }
+
+    free(calls);
+    free(callfiles);
+    free(bufs);
+}
+#endif
+
+/**
+ * Work out what fetchfile() should get for each file, 0 for nothing.
+ */
+static unsigned int getfetch(Options *options, unsigned int purpose)
+{
+    unsigned int what = 0;
+    if ((purpose & PREFETCH_RECURSE) && options->onefilesystem) {
+        /* to see which subdirectories are on other file systems */
+        what |= FETCH_DIRSTAT;
+    }
+    if (purpose & PREFETCH_ARGS) {
+        /* isstat() tells which exist, and then isdir() which are directories */
+        what |= FETCH_STAT;
+        if (options->followdirlinkargs) {
+            what |= FETCH_TARGET | FETCH_TARGETSTAT;
+        }
+    }
+    if (!(purpose & (PREFETCH_LIST | PREFETCH_ARGS))) {
+        return what;
+    }
+    if (options->needstat) {
+        what |= FETCH_STAT;
+    } else if (options->statfields & STAT_INO) {
+        /* readdir() has the inode numbers of everything but directories */
+        what |= FETCH_DIRSTAT;
+    }
+    if (options->summarize != SUMMARIZE_NONE) {
+        /* summaries only need each entry's own metadata */
+        return what;
+    }
+    if (options->showlink || options->showlinks || options->targetinfo == ON) {
+        what |= FETCH_TARGET;
+    }
+    if (options->showlinks || options->targetinfo == ON) {
+        what |= FETCH_TARGETSTAT;
+    }
+#ifdef HAVE_ACL
+    if (options->modes) {
+        what |= FETCH_ACLS;
+    }
+#endif
+    return what;
+}
+
+/* context points to what to fetch */
+static void fetchwhat(void *file, void *context)
+{
+    fetchfile(file, *(unsigned int *)context);
+}
+
+/* for a list that only borrows its files */
+static void nofree(void *file)
+{}
+
+/* context is the options */
+static void fetchtree(void *file, void *context)
+{
+    fetchtreesize(file, context);
+}
+
+/**
+ * Walk the trees under the directories in files on the pool's threads,
+ * one directory each, for --tree-size.
+ */
+static void prefetchtrees(List *files, Options *options)
+{
+    if (options->threads < 2 || pthread_mutex_trylock(&poollock) != 0) {
+        return;
+    }
+    List *dirs = newlist();
+    if (dirs) {
+        int nfiles = length(files);
+        for (int i = 0; i < nfiles; i++) {
+            File *file = getitem(files, i);
+            if (isdir(file)) {
+                append(file, dirs);
+            }
+        }
+        /* even two directories are worth it, each could be a big tree */
+        if (length(dirs) >= 2 && !options->pool) {
+            options->pool = newpool(options->threads);
+        }
+        if (length(dirs) >= 2 && options->pool) {
+            poolwalk(options->pool, dirs, fetchtree, options);
+        }
+        freelist(dirs, nofree);
+    }
+    pthread_mutex_unlock(&poollock);
+}
+
+/**
+ * Fetch what for files, in batches and on the pool's threads.
+ */
+static void prefetchstats(List *files, Options *options, unsigned int what)
+{
+    if (!what || length(files) < MINBATCH) {
+        /* types and inode numbers come from readdir(),
+         * and nothing else needs fetching */
+        return;
+    }
+#ifdef HAVE_IO_URING
+    if (what & (FETCH_STAT | FETCH_DIRSTAT)) {
+        prefetchuring(files, what);
+    }
+#endif
+    if (options->threads > 1 && length(files) >= MINPARALLEL
+            && pthread_mutex_trylock(&poollock) == 0) {
+        if (!options->pool) {
+            options->pool = newpool(options->threads);
+        }
+        if (options->pool) {
+            /* anything already stat'ed above isn't stat'ed again */
+            poolwalk(options->pool, files, fetchwhat, &what);
+        }
+        pthread_mutex_unlock(&poollock);
+    }
+}
+
+void prefetchfiles(List *files, Options *options, unsigned int purpose)
+{
+    if (!files || !options) {
+        errorf("files or options is NULL\n");
+        return;
+    }
+    prefetchstats(files, options, getfetch(options, purpose));
+    /* after the entries themselves, which the walks start from */
+    if (options->treesize && (purpose & PREFETCH_LIST)) {
+        prefetchtrees(files, options);
+    }
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
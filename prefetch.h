@@ -0,0 +1,26 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include "list.h"
+#include "options.h"
+
+/* what the files passed to prefetchfiles() are needed for */
+enum prefetchfor {
+    PREFETCH_LIST    = 1 << 0,  /* they're going to be listed */
+    PREFETCH_RECURSE = 1 << 1,  /* their subdirectories are going to be listed (-R) */
+    PREFETCH_ARGS    = 1 << 2,  /* they're arguments, to be sorted into files and directories,
+                                   and the files listed */
+};
+
+/**
+ * Fetch the metadata of all of files (a list of File *) in one go,
+ * if the options mean it will be needed for purpose,
+ * a mask of enum prefetchfor values.
+ *
+ * This is only an optimization: anything not fetched here is fetched
+ * when it's first needed, as usual, and errors are reported then either way.
+ */
+void prefetchfiles(List *files, Options *options, unsigned int purpose);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,164 @@
+#define _XOPEN_SOURCE 700   /* for mkdtemp() */
+#define _DEFAULT_SOURCE     /* for wait4() */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logging.h"
+
+/* entries in each directory of the test trees */
+#define NFILES 1000
+
+void test_recursive_memory_is_flat_with_depth(void);
+void test_long_memory_per_entry(void);
+
+int main(int argc, char **argv)
+{
+    myname = "scaletest";
+
+    test_recursive_memory_is_flat_with_depth();
+    test_long_memory_per_entry();
+    return 0;
+}
+
+/**
+ * Make a chain of depth directories under root, root/d, root/d/d, etc.,
+ * each holding NFILES empty files and the next directory.
+ */
+static void maketree(const char *root, int depth)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", root);
+    for (int i = 0; i < depth; i++) {
+        assert(strlen(path) + 2 < sizeof(path));
+        strcat(path, "/d");
+        assert(mkdir(path, 0755) == 0);
+        int dirfd = open(path, O_RDONLY | O_DIRECTORY);
+        assert(dirfd != -1);
+        for (int j = 0; j < NFILES; j++) {
+            char name[32];
+            snprintf(name, sizeof(name), "file%d", j);
+            int fd = openat(dirfd, name, O_WRONLY | O_CREAT, 0644);
+            assert(fd != -1);
+            close(fd);
+        }
+        close(dirfd);
+    }
+}
+
+static void removetree(const char *root, int depth)
+{
+    char path[PATH_MAX];
+    for (int i = depth; i > 0; i--) {
+        snprintf(path, sizeof(path), "%s", root);
+        for (int j = 0; j < i; j++) {
+            strcat(path, "/d");
+        }
+        int dirfd = open(path, O_RDONLY | O_DIRECTORY);
+        assert(dirfd != -1);
+        for (int j = 0; j < NFILES; j++) {
+            char name[32];
+            snprintf(name, sizeof(name), "file%d", j);
+            unlinkat(dirfd, name, 0);
+        }
+        close(dirfd);
+        rmdir(path);
+    }
+    rmdir(root);
+}
+
+/**
+ * Run ./l with flag on dir, discarding the output,
+ * and return its peak resident set size.
+ */
+static long peakrss(const char *flag, const char *dir)
+{
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execl("./l", "l", "--threads=1", flag, dir, (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    assert(wait4(pid, &status, 0, &usage) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    return usage.ru_maxrss;
+}
+
+void test_recursive_memory_is_flat_with_depth(void)
+{
+    char shallow[] = "/tmp/scaletest.XXXXXX";
+    char deep[] = "/tmp/scaletest.XXXXXX";
+    assert(mkdtemp(shallow) != NULL);
+    assert(mkdtemp(deep) != NULL);
+    maketree(shallow, 8);
+    maketree(deep, 24);
+
+    const char *flags[] = { "-R", "-lR" };
+    for (int i = 0; i < sizeof(flags) / sizeof(*flags); i++) {
+        long shallowrss = peakrss(flags[i], shallow);
+        long deeprss = peakrss(flags[i], deep);
+        /* three times as deep shouldn't need much more memory */
+        if (deeprss > shallowrss + shallowrss / 5) {
+            errorf("%s: peak RSS %ld at depth 8, %ld at depth 24\n",
+                   flags[i], shallowrss, deeprss);
+            assert(0);
+        }
+    }
+
+    removetree(shallow, 8);
+    removetree(deep, 24);
+}
+
+void test_long_memory_per_entry(void)
+{
+    const int nentries = 20 * NFILES;
+    char empty[] = "/tmp/scaletest.XXXXXX";
+    char full[] = "/tmp/scaletest.XXXXXX";
+    assert(mkdtemp(empty) != NULL);
+    assert(mkdtemp(full) != NULL);
+    int dirfd = open(full, O_RDONLY | O_DIRECTORY);
+    assert(dirfd != -1);
+    for (int i = 0; i < nentries; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "file%d", i);
+        int fd = openat(dirfd, name, O_WRONLY | O_CREAT, 0644);
+        assert(fd != -1);
+        close(fd);
+    }
+
+    /* each entry's File, fields and strings take under 1 KiB; a list of
+       each entry's fields used to take 8 KiB on its own */
+    long emptyrss = peakrss("-l", empty);
+    long fullrss = peakrss("-l", full);
+    printf("-l: peak RSS %ld KiB empty, %ld KiB with %d entries, %ld bytes each\n",
+           emptyrss, fullrss, nentries, (fullrss - emptyrss) * 1024 / nentries);
+    if (fullrss - emptyrss > 2 * nentries) {
+        errorf("-l: peak RSS %ld empty, %ld with %d entries\n",
+               emptyrss, fullrss, nentries);
+        assert(0);
+    }
+
+    for (int i = 0; i < nentries; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "file%d", i);
+        unlinkat(dirfd, name, 0);
+    }
+    close(dirfd);
+    rmdir(full);
+    rmdir(empty);
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
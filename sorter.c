@@ -0,0 +1,465 @@
+#define _XOPEN_SOURCE 700   /* for mkstemp(), fdopen() */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "sorter.h"
+
+/* runs merged into one as they're written, so only so many files are open */
+#define MAXMERGE 16
+
+typedef struct record {
+    size_t size;
+    unsigned char data[];
+} Record;
+
+/* a sorted temporary file */
+typedef struct run {
+    FILE *file;
+    int level;                      /* 0 if written from memory, else one more than the runs merged into it */
+} Run;
+
+/* where a merge has got to in one run */
+typedef struct cursor {
+    FILE *file;
+    size_t order;                   /* the run's position, so equal records stay in the order added */
+    Record *record;                 /* the run's next record, NULL once it's used up */
+    size_t capacity;                /* bytes allocated for record's data */
+} Cursor;
+
+struct sorter {
+    record_compare compare;
+    void *context;
+    size_t maxmemory;               /* bytes of records to keep in memory before writing them out */
+    size_t used;                    /* bytes of records in memory */
+    Record **records;               /* in memory, in the order added until sorted */
+    size_t nrecords;
+    size_t maxrecords;              /* room in records */
+    size_t next;                    /* with no runs, the next of records to return */
+    Run *runs;                      /* written out, oldest first */
+    size_t nruns;
+    size_t maxruns;                 /* room in runs */
+    size_t spilled;                 /* runs written out from memory, before any merging */
+    Cursor *heap;                   /* while merging, the runs, with the next record first */
+    size_t nheap;
+    bool advance;                   /* true = the first in heap was returned, and is done with */
+    bool sorted;                    /* true = sortrecords() was called */
+};
+
+Sorter *newsorter(size_t maxmemory, record_compare compare, void *context)
+{
+    if (!compare) {
+        errorf("compare is NULL\n");
+        return NULL;
+    }
+    Sorter *sorter = calloc(1, sizeof(*sorter));
+    if (!sorter) {
+        errorf("Out of memory\n");
+        return NULL;
+    }
+    sorter->compare = compare;
+    sorter->context = context;
+    sorter->maxmemory = maxmemory;
+    return sorter;
+}
+
+static void freerecords(Sorter *sorter)
+{
+    for (size_t i = 0; i < sorter->nrecords; i++) {
+        free(sorter->records[i]);
+    }
+    sorter->nrecords = 0;
+    sorter->used = 0;
+}
+
+void freesorter(Sorter *sorter)
+{
+    if (!sorter) return;
+    freerecords(sorter);
+    free(sorter->records);
+    for (size_t i = 0; i < sorter->nheap; i++) {
+        free(sorter->heap[i].record);
+    }
+    free(sorter->heap);
+    for (size_t i = 0; i < sorter->nruns; i++) {
+        fclose(sorter->runs[i].file);
+    }
+    free(sorter->runs);
+    free(sorter);
+}
+
+static int compare(Sorter *sorter, const Record *a, const Record *b)
+{
+    return sorter->compare(a->data, b->data, sorter->context);
+}
+
+/**
+ * Sort the records in memory, keeping equal ones in order.
+ *
+ * A bottom-up merge sort, since qsort() isn't stable and has no context.
+ */
+static bool sortmemory(Sorter *sorter)
+{
+    size_t n = sorter->nrecords;
+    if (n < 2) {
+        return true;
+    }
+    Record **temp = malloc(n * sizeof(*temp));
+    if (!temp) {
+        errorf("Out of memory\n");
+        return false;
+    }
+    Record **from = sorter->records;
+    Record **to = temp;
+    for (size_t width = 1; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                /* only from the right if it's strictly first */
+                to[k++] = compare(sorter, from[j], from[i]) < 0 ? from[j++] : from[i++];
+            }
+            while (i < mid) to[k++] = from[i++];
+            while (j < hi)  to[k++] = from[j++];
+        }
+        Record **swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != sorter->records) {
+        memcpy(sorter->records, from, n * sizeof(*from));
+    }
+    free(temp);
+    return true;
+}
+
+/**
+ * Create a temporary file that's already deleted.
+ */
+static FILE *opentemp(void)
+{
+    const char *dir = getenv("TMPDIR");
+    if (!dir || !*dir) {
+        dir = "/tmp";
+    }
+    char *path = malloc(strlen(dir) + sizeof("/l.XXXXXX"));
+    if (!path) {
+        errorf("Out of memory\n");
+        return NULL;
+    }
+    sprintf(path, "%s/l.XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        errorf("Cannot create temporary file in %s: %s\n", dir, strerror(errno));
+        free(path);
+        return NULL;
+    }
+    unlink(path);
+    free(path);
+    FILE *file = fdopen(fd, "w+");
+    if (!file) {
+        errorf("Cannot open temporary file: %s\n", strerror(errno));
+        close(fd);
+    }
+    return file;
+}
+
+static bool writerecord(FILE *file, const Record *record)
+{
+    return fwrite(&record->size, sizeof(record->size), 1, file) == 1 &&
+           fwrite(record->data, 1, record->size, file) == record->size;
+}
+
+/**
+ * Finish writing run, and add it to the end of sorter's runs.
+ */
+static bool addrun(Sorter *sorter, FILE *run, int level)
+{
+    if (fflush(run) != 0 || ferror(run)) {
+        errorf("Cannot write temporary file: %s\n", strerror(errno));
+        fclose(run);
+        return false;
+    }
+    if (sorter->nruns == sorter->maxruns) {
+        size_t maxruns = sorter->maxruns ? sorter->maxruns * 2 : 16;
+        Run *runs = realloc(sorter->runs, maxruns * sizeof(*runs));
+        if (!runs) {
+            errorf("Out of memory\n");
+            fclose(run);
+            return false;
+        }
+        sorter->runs = runs;
+        sorter->maxruns = maxruns;
+    }
+    sorter->runs[sorter->nruns].file = run;
+    sorter->runs[sorter->nruns].level = level;
+    sorter->nruns++;
+    return true;
+}
+
+static bool cascade(Sorter *sorter);
+
+/**
+ * Sort the records in memory, write them out as a run, and free them.
+ */
+static bool spill(Sorter *sorter)
+{
+    if (!sortmemory(sorter)) {
+        return false;
+    }
+    FILE *run = opentemp();
+    if (!run) {
+        return false;
+    }
+    bool ok = true;
+    for (size_t i = 0; i < sorter->nrecords && ok; i++) {
+        ok = writerecord(run, sorter->records[i]);
+    }
+    freerecords(sorter);
+    sorter->spilled++;
+    if (!ok) {
+        errorf("Cannot write temporary file: %s\n", strerror(errno));
+        fclose(run);
+        return false;
+    }
+    return addrun(sorter, run, 0) && cascade(sorter);
+}
+
+bool addrecord(Sorter *sorter, const void *data, size_t size)
+{
+    if (!sorter || sorter->sorted) {
+        errorf("sorter is NULL or already sorted\n");
+        return false;
+    }
+    size_t cost = sizeof(Record) + size + sizeof(Record *);
+    if (sorter->nrecords > 0 && sorter->used + cost > sorter->maxmemory) {
+        if (!spill(sorter)) {
+            return false;
+        }
+    }
+    if (sorter->nrecords == sorter->maxrecords) {
+        size_t maxrecords = sorter->maxrecords ? sorter->maxrecords * 2 : 256;
+        Record **records = realloc(sorter->records, maxrecords * sizeof(*records));
+        if (!records) {
+            errorf("Out of memory\n");
+            return false;
+        }
+        sorter->records = records;
+        sorter->maxrecords = maxrecords;
+    }
+    Record *record = malloc(sizeof(*record) + size);
+    if (!record) {
+        errorf("Out of memory\n");
+        return false;
+    }
+    record->size = size;
+    memcpy(record->data, data, size);
+    sorter->records[sorter->nrecords++] = record;
+    sorter->used += cost;
+    return true;
+}
+
+/**
+ * Read cursor's next record, setting it to NULL at the end of the run.
+ */
+static void readrecord(Cursor *cursor)
+{
+    size_t size;
+    if (fread(&size, sizeof(size), 1, cursor->file) != 1) {
+        if (ferror(cursor->file)) {
+            errorf("Cannot read temporary file: %s\n", strerror(errno));
+        }
+        free(cursor->record);
+        cursor->record = NULL;
+        return;
+    }
+    if (!cursor->record || size > cursor->capacity) {
+        Record *record = realloc(cursor->record, sizeof(*record) + size);
+        if (!record) {
+            errorf("Out of memory\n");
+            free(cursor->record);
+            cursor->record = NULL;
+            return;
+        }
+        cursor->record = record;
+        cursor->capacity = size;
+    }
+    cursor->record->size = size;
+    if (fread(cursor->record->data, 1, size, cursor->file) != size) {
+        errorf("Cannot read temporary file: %s\n", strerror(errno));
+        free(cursor->record);
+        cursor->record = NULL;
+    }
+}
+
+/* true if a's record comes before b's */
+static bool before(Sorter *sorter, const Cursor *a, const Cursor *b)
+{
+    int result = compare(sorter, a->record, b->record);
+    return result < 0 || (result == 0 && a->order < b->order);
+}
+
+static void siftdown(Sorter *sorter, size_t i)
+{
+    Cursor *heap = sorter->heap;
+    for (;;) {
+        size_t first = i;
+        size_t left = 2 * i + 1, right = 2 * i + 2;
+        if (left < sorter->nheap && before(sorter, &heap[left], &heap[first])) {
+            first = left;
+        }
+        if (right < sorter->nheap && before(sorter, &heap[right], &heap[first])) {
+            first = right;
+        }
+        if (first == i) {
+            return;
+        }
+        Cursor swap = heap[i];
+        heap[i] = heap[first];
+        heap[first] = swap;
+        i = first;
+    }
+}
+
+/**
+ * Drop the first cursor in the heap, e.g. once its run is used up.
+ */
+static void popcursor(Sorter *sorter)
+{
+    free(sorter->heap[0].record);
+    sorter->heap[0] = sorter->heap[--sorter->nheap];
+    siftdown(sorter, 0);
+}
+
+/**
+ * Start merging runs, which the heap doesn't own.
+ */
+static bool startmerge(Sorter *sorter, Run *runs, size_t nruns)
+{
+    free(sorter->heap);
+    sorter->heap = calloc(nruns, sizeof(*sorter->heap));
+    sorter->nheap = 0;
+    sorter->advance = false;
+    if (!sorter->heap) {
+        errorf("Out of memory\n");
+        return false;
+    }
+    for (size_t i = 0; i < nruns; i++) {
+        rewind(runs[i].file);
+        Cursor *cursor = &sorter->heap[sorter->nheap];
+        cursor->file = runs[i].file;
+        cursor->order = i;
+        readrecord(cursor);
+        if (cursor->record) {
+            sorter->nheap++;
+        }
+    }
+    for (size_t i = sorter->nheap; i-- > 0; ) {
+        siftdown(sorter, i);
+    }
+    return true;
+}
+
+/**
+ * Return the next record of the merge, or NULL at the end.
+ */
+static const Record *mergenext(Sorter *sorter)
+{
+    if (sorter->advance && sorter->nheap > 0) {
+        readrecord(&sorter->heap[0]);
+        if (sorter->heap[0].record) {
+            siftdown(sorter, 0);
+        } else {
+            popcursor(sorter);
+        }
+    }
+    sorter->advance = sorter->nheap > 0;
+    return sorter->nheap > 0 ? sorter->heap[0].record : NULL;
+}
+
+/**
+ * Whenever the last MAXMERGE runs were all written at the same level,
+ * merge them into one in their place, so there are at most MAXMERGE - 1
+ * runs at each level, and each record is only merged a few times.
+ */
+static bool cascade(Sorter *sorter)
+{
+    while (sorter->nruns >= MAXMERGE &&
+           sorter->runs[sorter->nruns - MAXMERGE].level == sorter->runs[sorter->nruns - 1].level) {
+        Run *first = &sorter->runs[sorter->nruns - MAXMERGE];
+        int level = first->level;
+        FILE *run = opentemp();
+        if (!run || !startmerge(sorter, first, MAXMERGE)) {
+            if (run) fclose(run);
+            return false;
+        }
+        const Record *record;
+        bool ok = true;
+        while (ok && (record = mergenext(sorter)) != NULL) {
+            ok = writerecord(run, record);
+        }
+        while (sorter->nheap > 0) {
+            popcursor(sorter);
+        }
+        if (!ok) {
+            errorf("Cannot write temporary file: %s\n", strerror(errno));
+            fclose(run);
+            return false;
+        }
+        for (size_t i = 0; i < MAXMERGE; i++) {
+            fclose(first[i].file);
+        }
+        sorter->nruns -= MAXMERGE;
+        if (!addrun(sorter, run, level + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sortrecords(Sorter *sorter)
+{
+    if (!sorter || sorter->sorted) {
+        errorf("sorter is NULL or already sorted\n");
+        return false;
+    }
+    sorter->sorted = true;
+    if (sorter->nruns == 0) {
+        return sortmemory(sorter);
+    }
+    if (sorter->nrecords > 0 && !spill(sorter)) {
+        return false;
+    }
+    return startmerge(sorter, sorter->runs, sorter->nruns);
+}
+
+const void *nextrecord(Sorter *sorter, size_t *psize)
+{
+    if (!sorter || !sorter->sorted) {
+        errorf("sorter is NULL or not sorted\n");
+        return NULL;
+    }
+    const Record *record = NULL;
+    if (sorter->nruns > 0) {
+        record = mergenext(sorter);
+    } else if (sorter->next < sorter->nrecords) {
+        record = sorter->records[sorter->next++];
+    }
+    if (!record) {
+        return NULL;
+    }
+    *psize = record->size;
+    return record->data;
+}
+
+size_t getrunscount(Sorter *sorter)
+{
+    return sorter ? sorter->spilled : 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,71 @@
+#ifndef SORTER_H
+#define SORTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Sorts more records than fit in memory.
+ *
+ * Records are byte strings, copied in as they're added.  Once they take
+ * more than the memory budget, they're sorted and written out to a
+ * temporary file as a "run", and at the end the runs are merged, so only
+ * one record from each run is in memory at a time.  If everything fits,
+ * nothing is written out.
+ *
+ * Temporary files go in $TMPDIR, or /tmp, and are deleted as soon as
+ * they're created, so they're cleaned up however the program ends.
+ */
+
+typedef struct sorter Sorter;
+
+/**
+ * Compare records a and b, like strcmp().  context is what was passed to newsorter().
+ */
+typedef int (*record_compare)(const void *a, const void *b, void *context);
+
+/**
+ * Create a sorter that keeps up to maxmemory bytes of records in memory
+ * before writing them out.
+ *
+ * Returns NULL on failure.
+ */
+Sorter *newsorter(size_t maxmemory, record_compare compare, void *context);
+
+/**
+ * Free sorter, its records, and its temporary files.
+ */
+void freesorter(Sorter *sorter);
+
+/**
+ * Add a copy of the size bytes at record.
+ *
+ * Returns false, having reported why, if it had to be written out and
+ * couldn't be, e.g. because the disk is full.
+ */
+bool addrecord(Sorter *sorter, const void *record, size_t size);
+
+/**
+ * Sort what's been added, so nextrecord() can return it in order.
+ * No more records can be added after this.
+ *
+ * Equal records come out in the order they were added.
+ * Returns false, having reported why, on failure.
+ */
+bool sortrecords(Sorter *sorter);
+
+/**
+ * Return the next record in order, and set *psize to its size,
+ * or return NULL at the end, or if it can't be read back.
+ *
+ * The record is only valid until the next call.
+ */
+const void *nextrecord(Sorter *sorter, size_t *psize);
+
+/**
+ * Return how many runs have been written out, 0 if everything fit in memory.
+ */
+size_t getrunscount(Sorter *sorter);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
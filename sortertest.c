@@ -0,0 +1,139 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "sorter.h"
+
+void test_fits_in_memory(void);
+void test_spills_runs(void);
+void test_many_runs_are_stable(void);
+void test_strings(void);
+
+int main(int argc, const char *argv[])
+{
+    myname = "sortertest";
+
+    test_fits_in_memory();
+    test_spills_runs();
+    test_many_runs_are_stable();
+    test_strings();
+    return 0;
+}
+
+typedef struct item {
+    int key;
+    int seq;                        /* order added */
+} Item;
+
+/* by key only, so stability shows in seq; context is the number of calls */
+static int compareitems(const void *a, const void *b, void *context)
+{
+    const Item *x = a, *y = b;
+    (*(size_t *)context)++;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+/* add n items with keys from 0 to range-1, and check they come out in order */
+static void sortitems(size_t maxmemory, int n, int range, size_t *pruns)
+{
+    size_t calls = 0;
+    Sorter *sorter = newsorter(maxmemory, compareitems, &calls);
+    assert(sorter);
+    srand(n);
+    for (int i = 0; i < n; i++) {
+        Item item = { rand() % range, i };
+        assert(addrecord(sorter, &item, sizeof(item)));
+    }
+    assert(sortrecords(sorter));
+    assert(calls > 0 || n < 2);
+
+    const Item *item;
+    Item last = { -1, -1 };
+    size_t size;
+    int count = 0;
+    while ((item = nextrecord(sorter, &size)) != NULL) {
+        assert(size == sizeof(*item));
+        assert(item->key >= last.key);
+        if (item->key == last.key) {
+            assert(item->seq > last.seq);
+        }
+        last = *item;
+        count++;
+    }
+    assert(count == n);
+    assert(nextrecord(sorter, &size) == NULL);
+    *pruns = getrunscount(sorter);
+    freesorter(sorter);
+}
+
+void test_fits_in_memory(void)
+{
+    size_t runs;
+    sortitems(1 << 20, 1000, 10, &runs);
+    assert(runs == 0);
+    sortitems(1 << 20, 0, 10, &runs);
+    assert(runs == 0);
+    sortitems(0, 1, 10, &runs);
+    assert(runs == 0);
+}
+
+void test_spills_runs(void)
+{
+    size_t runs;
+    sortitems(4096, 10000, 1000, &runs);
+    assert(runs > 1);
+    /* every record in its own run */
+    sortitems(1, 100, 10, &runs);
+    assert(runs == 100);
+}
+
+void test_many_runs_are_stable(void)
+{
+    /* more runs than are merged at once, twice over, with lots of equal keys */
+    size_t runs;
+    sortitems(1024, 20000, 7, &runs);
+    assert(runs > 16 * 16);
+}
+
+static int comparestrings(const void *a, const void *b, void *context)
+{
+    return strcmp(a, b);
+}
+
+void test_strings(void)
+{
+    static const char *words[] = {
+        "pear", "apple", "fig", "banana", "kiwi", "cherry", "date", "", "grape",
+    };
+    const int n = sizeof(words) / sizeof(*words);
+    Sorter *sorter = newsorter(64, comparestrings, NULL);
+    assert(sorter);
+    for (int i = 0; i < n; i++) {
+        assert(addrecord(sorter, words[i], strlen(words[i]) + 1));
+    }
+    assert(sortrecords(sorter));
+    assert(getrunscount(sorter) > 1);
+
+    const char *word, *last = NULL;
+    char *copy = NULL;
+    size_t size;
+    int count = 0;
+    while ((word = nextrecord(sorter, &size)) != NULL) {
+        assert(size == strlen(word) + 1);
+        if (last) {
+            assert(strcmp(last, word) <= 0);
+        }
+        free(copy);
+        last = copy = strdup(word);
+        count++;
+    }
+    free(copy);
+    assert(count == n);
+    freesorter(sorter);
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,326 @@
+#define _XOPEN_SOURCE 700   /* for localtime_r(), strdup() */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "file.h"
+#include "list.h"
+#include "logging.h"
+#include "summary.h"
+
+struct summary {
+    pthread_mutex_t lock;           /* protects everything below */
+    enum summarize by;
+    SummaryGroup **groups;          /* open addressing, with NULL for an empty slot */
+    size_t ngroups;
+    size_t capacity;                /* a power of 2, at least twice ngroups */
+};
+
+static const struct {
+    const char *name;
+    enum summarize by;
+} keys[] = {
+    { "ext",            SUMMARIZE_EXT },
+    { "group",          SUMMARIZE_GROUP },
+    { "mtime-month",    SUMMARIZE_MONTH },
+    { "owner",          SUMMARIZE_OWNER },
+    { "type",           SUMMARIZE_TYPE },
+};
+
+/* SUMMARIZE_TYPE keys */
+static const char *typenames[] = {
+    "file", "directory", "link", "fifo", "socket", "block", "char"
+};
+
+bool parsesummarize(const char *text, enum summarize *pby)
+{
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (strcmp(text, keys[i].name) == 0) {
+            *pby = keys[i].by;
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned int getsummaryfields(enum summarize by)
+{
+    switch (by) {
+    case SUMMARIZE_NONE:
+    case SUMMARIZE_COUNT:
+        return 0;
+    case SUMMARIZE_OWNER:
+        return STAT_UID|STAT_SIZE|STAT_BLOCKS;
+    case SUMMARIZE_GROUP:
+        return STAT_GID|STAT_SIZE|STAT_BLOCKS;
+    case SUMMARIZE_MONTH:
+        return STAT_MTIME|STAT_SIZE|STAT_BLOCKS;
+    case SUMMARIZE_EXT:
+    case SUMMARIZE_TYPE:
+        return STAT_SIZE|STAT_BLOCKS;
+    }
+    return 0;
+}
+
+Summary *newsummary(enum summarize by)
+{
+    Summary *summary = calloc(1, sizeof(*summary));
+    if (summary) {
+        summary->capacity = 64;
+        summary->groups = calloc(summary->capacity, sizeof(*summary->groups));
+    }
+    if (!summary || !summary->groups) {
+        errorf("Out of memory\n");
+        free(summary);
+        return NULL;
+    }
+    pthread_mutex_init(&summary->lock, NULL);
+    summary->by = by;
+    return summary;
+}
+
+void freesummary(Summary *summary)
+{
+    if (!summary) return;
+    for (size_t i = 0; i < summary->capacity; i++) {
+        if (summary->groups[i]) {
+            free(summary->groups[i]->ext);
+            free(summary->groups[i]);
+        }
+    }
+    free(summary->groups);
+    pthread_mutex_destroy(&summary->lock);
+    free(summary);
+}
+
+/**
+ * Return the extension of file's name, after the last ".", or "" if it
+ * has none.  A leading "." starts a hidden name, not an extension.
+ */
+static const char *getextension(File *file)
+{
+    const char *name = getname(file);
+    const char *slash = strrchr(name, '/');
+    if (slash && slash[1] != '\0') {
+        name = slash + 1;
+    }
+    const char *dot = strrchr(name, '.');
+    if (!dot || dot == name) {
+        return "";
+    }
+    return dot + 1;
+}
+
+/**
+ * Set group's key to file's, returning false if file doesn't have one,
+ * e.g. because it couldn't be stat'ed.  group->ext isn't copied.
+ */
+static bool getkey(Summary *summary, File *file, SummaryGroup *group)
+{
+    struct tm tm;
+    time_t mtime;
+
+    switch (summary->by) {
+    case SUMMARIZE_NONE:
+    case SUMMARIZE_COUNT:
+        return true;
+    case SUMMARIZE_OWNER:
+        if (!isstat(file)) return false;
+        group->key = getownernum(file);
+        return true;
+    case SUMMARIZE_GROUP:
+        if (!isstat(file)) return false;
+        group->key = getgroupnum(file);
+        return true;
+    case SUMMARIZE_EXT:
+        group->ext = (char *)getextension(file);
+        return true;
+    case SUMMARIZE_TYPE:
+        if (!hastype(file)) return false;
+        group->key = isdir(file) ? 1 : islink(file) ? 2 : isfifo(file) ? 3 :
+            issock(file) ? 4 : isblockdev(file) ? 5 : ischardev(file) ? 6 : 0;
+        return true;
+    case SUMMARIZE_MONTH:
+        if (!isstat(file)) return false;
+        mtime = getmtime(file);
+        if (!localtime_r(&mtime, &tm)) return false;
+        group->key = (uintmax_t)(tm.tm_year + 1900) * 12 + tm.tm_mon;
+        return true;
+    }
+    return false;
+}
+
+static size_t hashgroup(const SummaryGroup *group)
+{
+    uint64_t hash;
+    if (group->ext) {
+        /* FNV-1a */
+        hash = 14695981039346656037ULL;
+        for (const unsigned char *s = (const unsigned char *)group->ext; *s; s++) {
+            hash = (hash ^ *s) * 1099511628211ULL;
+        }
+    } else {
+        hash = (group->key + group->known) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 32;
+    }
+    return (size_t)hash;
+}
+
+static bool samegroup(const SummaryGroup *a, const SummaryGroup *b)
+{
+    if (a->known != b->known || a->key != b->key) {
+        return false;
+    }
+    return !a->ext || strcmp(a->ext, b->ext) == 0;
+}
+
+/* the slot for group: where it is, or where it would go */
+static size_t findslot(SummaryGroup **groups, size_t capacity, const SummaryGroup *group)
+{
+    size_t i = hashgroup(group) & (capacity - 1);
+    while (groups[i] && !samegroup(groups[i], group)) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return i;
+}
+
+static bool grow(Summary *summary)
+{
+    size_t capacity = summary->capacity * 2;
+    SummaryGroup **groups = calloc(capacity, sizeof(*groups));
+    if (!groups) {
+        errorf("Out of memory\n");
+        return false;
+    }
+    for (size_t i = 0; i < summary->capacity; i++) {
+        if (summary->groups[i]) {
+            groups[findslot(groups, capacity, summary->groups[i])] = summary->groups[i];
+        }
+    }
+    free(summary->groups);
+    summary->groups = groups;
+    summary->capacity = capacity;
+    return true;
+}
+
+void addtosummary(Summary *summary, File *file, int blocksize)
+{
+    SummaryGroup key = { 0 };
+    key.known = getkey(summary, file, &key);
+    unsigned long long bytes = 0, blocks = 0;
+    if (summary->by != SUMMARIZE_COUNT && isstat(file)) {
+        bytes = getsize(file);
+        blocks = getblocks(file, blocksize);
+    }
+
+    pthread_mutex_lock(&summary->lock);
+    size_t i = findslot(summary->groups, summary->capacity, &key);
+    SummaryGroup *group = summary->groups[i];
+    if (!group) {
+        if ((summary->ngroups + 1) * 2 > summary->capacity) {
+            if (!grow(summary)) {
+                pthread_mutex_unlock(&summary->lock);
+                return;
+            }
+            i = findslot(summary->groups, summary->capacity, &key);
+        }
+        group = malloc(sizeof(*group));
+        if (group) {
+            *group = key;
+            group->ext = key.ext ? strdup(key.ext) : NULL;
+        }
+        if (!group || (key.ext && !group->ext)) {
+            errorf("Out of memory\n");
+            free(group);
+            pthread_mutex_unlock(&summary->lock);
+            return;
+        }
+        summary->groups[i] = group;
+        summary->ngroups++;
+    }
+    group->count++;
+    group->bytes += bytes;
+    group->blocks += blocks;
+    pthread_mutex_unlock(&summary->lock);
+}
+
+static int comparegroups(const void **a, const void **b)
+{
+    const SummaryGroup *x = *a, *y = *b;
+    if (x->known != y->known) {
+        return x->known ? -1 : 1;
+    }
+    if (x->ext && y->ext) {
+        return strcmp(x->ext, y->ext);
+    }
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+List *getsummarygroups(Summary *summary)
+{
+    List *list = newlist();
+    if (!list) {
+        errorf("list is NULL\n");
+        return NULL;
+    }
+    pthread_mutex_lock(&summary->lock);
+    for (size_t i = 0; i < summary->capacity; i++) {
+        if (summary->groups[i]) {
+            append(summary->groups[i], list);
+        }
+    }
+    pthread_mutex_unlock(&summary->lock);
+    sortlist(list, comparegroups);
+    return list;
+}
+
+char *getsummarykey(Summary *summary, const SummaryGroup *group)
+{
+    char buf[64];
+    const char *text = buf;
+    if (!group->known) {
+        text = "?";
+    } else {
+        switch (summary->by) {
+        case SUMMARIZE_NONE:
+        case SUMMARIZE_COUNT:
+            text = "";
+            break;
+        case SUMMARIZE_OWNER:
+        case SUMMARIZE_GROUP:
+            snprintf(buf, sizeof(buf), "%ju", group->key);
+            break;
+        case SUMMARIZE_EXT:
+            if (!group->ext[0]) {
+                text = "(none)";
+            } else {
+                char *key = malloc(strlen(group->ext) + 2);
+                if (key) {
+                    key[0] = '.';
+                    strcpy(key + 1, group->ext);
+                    return key;
+                }
+                text = NULL;
+            }
+            break;
+        case SUMMARIZE_TYPE:
+            text = group->key < sizeof(typenames) / sizeof(typenames[0]) ?
+                typenames[group->key] : "?";
+            break;
+        case SUMMARIZE_MONTH:
+            snprintf(buf, sizeof(buf), "%04ju-%02ju", group->key / 12, group->key % 12 + 1);
+            break;
+        }
+    }
+    char *key = text ? strdup(text) : NULL;
+    if (!key) {
+        errorf("Out of memory\n");
+    }
+    return key;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,85 @@
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "file.h"
+#include "list.h"
+
+/*
+ * Totals of the files listed, grouped by owner, extension, etc., for
+ * --summarize-by and --count, instead of a line for each file.
+ *
+ * Groups are kept in a hash table keyed by the uid, gid, extension, etc.,
+ * so adding a file is a lookup and three additions, and nothing about
+ * the file is formatted.  Files can be added from several threads at once.
+ */
+
+/* what files are grouped by */
+enum summarize {
+    SUMMARIZE_NONE,                 /* no summary, list the files */
+    SUMMARIZE_COUNT,                /* everything in one group, just counted */
+    SUMMARIZE_OWNER,
+    SUMMARIZE_GROUP,
+    SUMMARIZE_EXT,                  /* the name's extension */
+    SUMMARIZE_TYPE,                 /* file, directory, link, etc. */
+    SUMMARIZE_MONTH,                /* the month of the mtime */
+};
+
+typedef struct summary Summary;
+
+/* the files in one group */
+typedef struct summarygroup {
+    bool known;                     /* false = no key, e.g. the file couldn't be stat'ed */
+    uintmax_t key;                  /* the uid, gid, type (0 = file, 1 = directory, ...), or year * 12 + month */
+    char *ext;                      /* with SUMMARIZE_EXT, the extension, "" for none */
+    unsigned long count;
+    unsigned long long bytes;
+    unsigned long long blocks;      /* in the blocksize passed to addtosummary() */
+} SummaryGroup;
+
+/**
+ * Set *pby to what text, e.g. "owner" or "mtime-month", names.
+ *
+ * Returns false if it names nothing.
+ */
+bool parsesummarize(const char *text, enum summarize *pby);
+
+/**
+ * Return the metadata needed to summarize by by, a mask of enum statfield values.
+ */
+unsigned int getsummaryfields(enum summarize by);
+
+/**
+ * Create an empty summary, grouping files by by.
+ *
+ * Returns NULL on failure.
+ */
+Summary *newsummary(enum summarize by);
+
+/**
+ * Free summary, and its groups.
+ */
+void freesummary(Summary *summary);
+
+/**
+ * Add file to its group, stat'ing it if the group or totals need it,
+ * with its blocks counted in units of blocksize.
+ */
+void addtosummary(Summary *summary, File *file, int blocksize);
+
+/**
+ * Return a new list of the groups, in order of their keys, with the
+ * files without one last.  The groups still belong to summary.
+ */
+List *getsummarygroups(Summary *summary);
+
+/**
+ * Return how group's key should be shown, e.g. ".c", "directory" or
+ * "2024-05", or for owners and groups, their number.  The caller frees it.
+ */
+char *getsummarykey(Summary *summary, const SummaryGroup *group);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,238 @@
+#define _XOPEN_SOURCE 700   /* for mkdtemp(), symlink() */
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "file.h"
+#include "list.h"
+#include "logging.h"
+#include "summary.h"
+
+void test_parse(void);
+void test_ext(void);
+void test_type(void);
+void test_unknown(void);
+void test_many_groups(void);
+void test_threads(void);
+
+static char tempdirname[] = "/tmp/summarytestXXXXXX";
+
+static void makefile(const char *name, size_t size)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", tempdirname, name);
+    FILE *f = fopen(path, "w");
+    assert(f);
+    for (size_t i = 0; i < size; i++) {
+        fputc('x', f);
+    }
+    fclose(f);
+}
+
+static void removefiles(void)
+{
+    const char *names[] = { "a.c", "b.c", "c.h", "README", ".hidden", "dir", "link" };
+    char path[PATH_MAX];
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", tempdirname, names[i]);
+        remove(path);
+    }
+    rmdir(tempdirname);
+}
+
+int main(int argc, const char *argv[])
+{
+    myname = "summarytest";
+
+    assert(mkdtemp(tempdirname) != NULL);
+    makefile("a.c", 10);
+    makefile("b.c", 20);
+    makefile("c.h", 5);
+    makefile("README", 3);
+    makefile(".hidden", 1);
+
+    test_parse();
+    test_ext();
+    test_type();
+    test_unknown();
+    test_many_groups();
+    test_threads();
+
+    removefiles();
+    return 0;
+}
+
+static void nofree(void *group)
+{
+    /* groups belong to the summary */
+}
+
+/* add the named files in tempdirname to summary */
+static void addfiles(Summary *summary, const char *names[], size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        File *file = newfile(tempdirname, names[i]);
+        assert(file);
+        addtosummary(summary, file, 1024);
+        freefile(file);
+    }
+}
+
+/* check that group i has key and count */
+static void checkgroup(Summary *summary, List *groups, size_t i,
+                       const char *key, unsigned long count)
+{
+    SummaryGroup *group = getitem(groups, i);
+    char *text = getsummarykey(summary, group);
+    assert(strcmp(text, key) == 0);
+    assert(group->count == count);
+    free(text);
+}
+
+void test_parse(void)
+{
+    enum summarize by = SUMMARIZE_NONE;
+    assert(parsesummarize("owner", &by) && by == SUMMARIZE_OWNER);
+    assert(parsesummarize("mtime-month", &by) && by == SUMMARIZE_MONTH);
+    assert(!parsesummarize("size", &by));
+    assert(!parsesummarize("", &by));
+
+    /* counting doesn't need a stat */
+    assert(getsummaryfields(SUMMARIZE_COUNT) == 0);
+    assert(getsummaryfields(SUMMARIZE_OWNER) & STAT_UID);
+}
+
+void test_ext(void)
+{
+    Summary *summary = newsummary(SUMMARIZE_EXT);
+    assert(summary);
+    const char *names[] = { "a.c", "README", "c.h", "b.c", ".hidden" };
+    addfiles(summary, names, 5);
+
+    List *groups = getsummarygroups(summary);
+    assert(length(groups) == 3);
+    checkgroup(summary, groups, 0, "(none)", 2);
+    checkgroup(summary, groups, 1, ".c", 2);
+    checkgroup(summary, groups, 2, ".h", 1);
+    SummaryGroup *group = getitem(groups, 1);
+    assert(group->bytes == 30);
+    group = getitem(groups, 0);
+    assert(group->bytes == 4);
+    freelist(groups, (free_func)nofree);
+    freesummary(summary);
+}
+
+void test_type(void)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/dir", tempdirname);
+    assert(mkdir(path, 0755) == 0);
+    snprintf(path, sizeof(path), "%s/link", tempdirname);
+    assert(symlink("a.c", path) == 0);
+
+    Summary *summary = newsummary(SUMMARIZE_TYPE);
+    assert(summary);
+    const char *names[] = { "a.c", "link", "dir", "b.c" };
+    addfiles(summary, names, 4);
+
+    List *groups = getsummarygroups(summary);
+    assert(length(groups) == 3);
+    checkgroup(summary, groups, 0, "file", 2);
+    checkgroup(summary, groups, 1, "directory", 1);
+    checkgroup(summary, groups, 2, "link", 1);
+    freelist(groups, (free_func)nofree);
+    freesummary(summary);
+}
+
+void test_unknown(void)
+{
+    Summary *summary = newsummary(SUMMARIZE_OWNER);
+    assert(summary);
+    const char *names[] = { "missing", "a.c", "b.c" };
+    addfiles(summary, names, 3);
+
+    /* a file that can't be stat'ed has no owner, and comes last */
+    List *groups = getsummarygroups(summary);
+    assert(length(groups) == 2);
+    char key[32];
+    snprintf(key, sizeof(key), "%lu", (unsigned long)getuid());
+    checkgroup(summary, groups, 0, key, 2);
+    checkgroup(summary, groups, 1, "?", 1);
+    SummaryGroup *group = getitem(groups, 1);
+    assert(group->bytes == 0 && group->blocks == 0);
+    freelist(groups, (free_func)nofree);
+    freesummary(summary);
+}
+
+void test_many_groups(void)
+{
+    /* enough to grow the table several times */
+    const int n = 300;
+    char name[32], path[PATH_MAX];
+    for (int i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "f.e%03d", i);
+        makefile(name, 1);
+    }
+    Summary *summary = newsummary(SUMMARIZE_EXT);
+    assert(summary);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = n; i-- > 0; ) {
+            snprintf(name, sizeof(name), "f.e%03d", i);
+            File *file = newfile(tempdirname, name);
+            addtosummary(summary, file, 1024);
+            freefile(file);
+        }
+    }
+    List *groups = getsummarygroups(summary);
+    assert(length(groups) == n);
+    for (int i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), ".e%03d", i);
+        checkgroup(summary, groups, i, name, 2);
+        assert(((SummaryGroup *)getitem(groups, i))->bytes == 2);
+    }
+    freelist(groups, (free_func)nofree);
+    freesummary(summary);
+
+    for (int i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), "%s/f.e%03d", tempdirname, i);
+        remove(path);
+    }
+}
+
+static void *addmany(void *arg)
+{
+    Summary *summary = arg;
+    const char *names[] = { "a.c", "b.c", "c.h", "README" };
+    for (int i = 0; i < 250; i++) {
+        addfiles(summary, names, 4);
+    }
+    return NULL;
+}
+
+void test_threads(void)
+{
+    Summary *summary = newsummary(SUMMARIZE_COUNT);
+    assert(summary);
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        assert(pthread_create(&threads[i], NULL, addmany, summary) == 0);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    List *groups = getsummarygroups(summary);
+    assert(length(groups) == 1);
+    SummaryGroup *group = getitem(groups, 0);
+    assert(group->count == 4000);
+    /* counting doesn't total sizes */
+    assert(group->bytes == 0);
+    freelist(groups, (free_func)nofree);
+    freesummary(summary);
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,155 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "list.h"
+#include "logging.h"
+#include "top.h"
+
+struct top {
+    pthread_mutex_t lock;           /* protects everything below */
+    top_compare compare;
+    void *context;
+    size_t max;                     /* items to keep */
+    void **items;                   /* a heap, with the last kept item first */
+    size_t nitems;
+    size_t capacity;                /* room in items, which grows up to max */
+};
+
+Top *newtop(size_t max, top_compare compare, void *context)
+{
+    if (max == 0 || !compare) {
+        errorf("max is 0 or compare is NULL\n");
+        return NULL;
+    }
+    Top *top = calloc(1, sizeof(*top));
+    if (!top) {
+        errorf("Out of memory\n");
+        return NULL;
+    }
+    pthread_mutex_init(&top->lock, NULL);
+    top->compare = compare;
+    top->context = context;
+    top->max = max;
+    return top;
+}
+
+void freetop(Top *top, free_func freeitem)
+{
+    if (!top) return;
+    for (size_t i = 0; i < top->nitems; i++) {
+        freeitem(top->items[i]);
+    }
+    free(top->items);
+    pthread_mutex_destroy(&top->lock);
+    free(top);
+}
+
+/* true if a comes after b, so it belongs above it in the heap */
+static bool after(Top *top, const void *a, const void *b)
+{
+    return top->compare(a, b, top->context) > 0;
+}
+
+static void siftup(Top *top, size_t i)
+{
+    void **items = top->items;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!after(top, items[i], items[parent])) {
+            return;
+        }
+        void *swap = items[i];
+        items[i] = items[parent];
+        items[parent] = swap;
+        i = parent;
+    }
+}
+
+static void siftdown(Top *top, size_t i)
+{
+    void **items = top->items;
+    for (;;) {
+        size_t last = i;
+        size_t left = 2 * i + 1, right = 2 * i + 2;
+        if (left < top->nitems && after(top, items[left], items[last])) {
+            last = left;
+        }
+        if (right < top->nitems && after(top, items[right], items[last])) {
+            last = right;
+        }
+        if (last == i) {
+            return;
+        }
+        void *swap = items[i];
+        items[i] = items[last];
+        items[last] = swap;
+        i = last;
+    }
+}
+
+bool wouldkeep(Top *top, const void *item)
+{
+    pthread_mutex_lock(&top->lock);
+    bool keep = top->nitems < top->max || after(top, top->items[0], item);
+    pthread_mutex_unlock(&top->lock);
+    return keep;
+}
+
+void *addtop(Top *top, void *item)
+{
+    void *dropped = NULL;
+    pthread_mutex_lock(&top->lock);
+    if (top->nitems < top->max) {
+        if (top->nitems == top->capacity) {
+            /* grown as needed, since max might be much more than are added */
+            size_t capacity = top->capacity ? top->capacity * 2 : 64;
+            if (capacity > top->max) {
+                capacity = top->max;
+            }
+            void **items = realloc(top->items, capacity * sizeof(*items));
+            if (!items) {
+                errorf("Out of memory\n");
+                pthread_mutex_unlock(&top->lock);
+                return item;
+            }
+            top->items = items;
+            top->capacity = capacity;
+        }
+        top->items[top->nitems] = item;
+        siftup(top, top->nitems++);
+    } else if (after(top, top->items[0], item)) {
+        dropped = top->items[0];
+        top->items[0] = item;
+        siftdown(top, 0);
+    } else {
+        dropped = item;
+    }
+    pthread_mutex_unlock(&top->lock);
+    return dropped;
+}
+
+List *taketop(Top *top)
+{
+    List *list = newlist();
+    if (!list) {
+        errorf("list is NULL\n");
+        return NULL;
+    }
+    pthread_mutex_lock(&top->lock);
+    /* taking the last each time leaves them in order from the end */
+    size_t n = top->nitems;
+    for (size_t i = n; i-- > 0; ) {
+        void *item = top->items[0];
+        top->items[0] = top->items[--top->nitems];
+        siftdown(top, 0);
+        top->items[top->nitems] = item;
+    }
+    for (size_t i = 0; i < n; i++) {
+        append(top->items[i], list);
+    }
+    pthread_mutex_unlock(&top->lock);
+    return list;
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
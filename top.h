@@ -0,0 +1,61 @@
+#ifndef TOP_H
+#define TOP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "list.h"
+
+/*
+ * Keeps the first few of many items, in some order, e.g. the 20 newest
+ * files in a tree, without sorting, or even keeping, all of them.
+ *
+ * The items kept are in a heap with the last of them at the top, so each
+ * item added is checked against just that one, and only replaces it if it
+ * comes first.  Memory is only needed for the items kept.
+ *
+ * Items can be added from several threads at once.
+ */
+
+typedef struct top Top;
+
+/**
+ * Compare items a and b, like strcmp().  context is what was passed to newtop().
+ */
+typedef int (*top_compare)(const void *a, const void *b, void *context);
+
+/**
+ * Create a Top to keep the first max items added to it.
+ *
+ * Returns NULL on failure.
+ */
+Top *newtop(size_t max, top_compare compare, void *context);
+
+/**
+ * Free top, and with freeitem, the items it still has.
+ */
+void freetop(Top *top, free_func freeitem);
+
+/**
+ * Return true if item would be kept if it was added now,
+ * e.g. to only do the work of making an item for ones that would be.
+ */
+bool wouldkeep(Top *top, const void *item);
+
+/**
+ * Add item, which top takes over.
+ *
+ * Returns the item that no longer fits, for the caller to free: item itself
+ * if it isn't one of the first, the one it replaced, or NULL if there was room.
+ */
+void *addtop(Top *top, void *item);
+
+/**
+ * Return a new list of the items kept, first first, which the caller owns.
+ *
+ * top is left empty.
+ */
+List *taketop(Top *top);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
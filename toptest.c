@@ -0,0 +1,138 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "list.h"
+#include "logging.h"
+#include "top.h"
+
+void test_keeps_first(void);
+void test_fewer_than_max(void);
+void test_threads(void);
+
+int main(int argc, const char *argv[])
+{
+    myname = "toptest";
+
+    test_keeps_first();
+    test_fewer_than_max();
+    test_threads();
+    return 0;
+}
+
+static int compareints(const void *a, const void *b, void *context)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static int *newint(int value)
+{
+    int *p = malloc(sizeof(*p));
+    assert(p);
+    *p = value;
+    return p;
+}
+
+static int compareinta(const void **a, const void **b)
+{
+    return compareints(*a, *b, NULL);
+}
+
+void test_keeps_first(void)
+{
+    const int n = 10000, max = 25;
+    Top *top = newtop(max, compareints, NULL);
+    assert(top);
+    List *all = newlist();
+    srand(1);
+    int ndropped = 0;
+    for (int i = 0; i < n; i++) {
+        int *item = newint(rand() % 5000);
+        append(item, all);
+        if (wouldkeep(top, item)) {
+            int *dropped = addtop(top, newint(*item));
+            if (dropped) {
+                ndropped++;
+                free(dropped);
+            }
+        }
+    }
+    /* nothing's kept after the first few unless it belongs */
+    assert(ndropped < n / 10);
+
+    sortlist(all, compareinta);
+    List *first = taketop(top);
+    assert(length(first) == max);
+    for (int i = 0; i < max; i++) {
+        assert(*(int *)getitem(first, i) == *(int *)getitem(all, i));
+    }
+    freelist(first, free);
+    freelist(all, free);
+
+    /* taken, so empty */
+    first = taketop(top);
+    assert(length(first) == 0);
+    freelist(first, free);
+    freetop(top, free);
+}
+
+void test_fewer_than_max(void)
+{
+    Top *top = newtop(100, compareints, NULL);
+    assert(top);
+    int values[] = { 5, 3, 9, 1, 7 };
+    for (int i = 0; i < 5; i++) {
+        assert(addtop(top, newint(values[i])) == NULL);
+    }
+    List *first = taketop(top);
+    assert(length(first) == 5);
+    for (int i = 0; i < 5; i++) {
+        assert(*(int *)getitem(first, i) == 2 * i + 1);
+    }
+    freelist(first, free);
+
+    /* what's left is freed */
+    addtop(top, newint(1));
+    freetop(top, free);
+
+    int *item = newint(2);
+    top = newtop(1, compareints, NULL);
+    assert(addtop(top, newint(1)) == NULL);
+    assert(!wouldkeep(top, item));
+    assert(addtop(top, item) == item);
+    free(item);
+    freetop(top, free);
+}
+
+static void *addmany(void *arg)
+{
+    Top *top = arg;
+    for (int i = 0; i < 10000; i++) {
+        free(addtop(top, newint(rand() % 100000)));
+    }
+    return NULL;
+}
+
+void test_threads(void)
+{
+    Top *top = newtop(50, compareints, NULL);
+    assert(top);
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        assert(pthread_create(&threads[i], NULL, addmany, top) == 0);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    List *first = taketop(top);
+    assert(length(first) == 50);
+    for (int i = 1; i < 50; i++) {
+        assert(*(int *)getitem(first, i - 1) <= *(int *)getitem(first, i));
+    }
+    freelist(first, free);
+    freetop(top, free);
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,470 @@
+#define _XOPEN_SOURCE 700   /* for fstat() */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dir.h"
+#include "file.h"
+#include "list.h"
+#include "logging.h"
+#include "options.h"
+#include "pattern.h"
+#include "predicate.h"
+#include "treesize.h"
+
+/* directory entries read at once while walking; kept small since
+ * there's one reader for each directory being walked at a time */
+#define WALKBUFSIZE (32 * 1024)
+
+/* a file with more than one link, already counted */
+typedef struct inode {
+    dev_t dev;
+    ino_t ino;                      /* 0 = empty slot */
+    unsigned long blocks;
+} Inode;
+
+/* hash set of Inodes */
+typedef struct inodeset {
+    Inode *slots;
+    size_t capacity;                /* a power of two, or 0 */
+    size_t count;
+} InodeSet;
+
+/* the totals for a directory being walked */
+typedef struct level {
+    TreeSize size;
+    InodeSet links;                 /* files with several links counted in size */
+} Level;
+
+/* the directories being walked into, to spot cycles */
+typedef struct ancestor {
+    dev_t dev;
+    ino_t ino;
+    struct ancestor *up;
+} Ancestor;
+
+/* a walked directory's size, kept until it's asked for */
+typedef struct sizeentry {
+    dev_t dev;
+    ino_t ino;
+    TreeSize size;
+    char *errors;                   /* error messages from the walk, NULL if none */
+    struct sizeentry *next;
+} SizeEntry;
+
+/* sizes worked out but not yet asked for, by inode */
+static SizeEntry **sizes = NULL;
+static size_t nslots = 0;
+static size_t nsizes = 0;
+static pthread_mutex_t sizeslock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t hashinode(dev_t dev, ino_t ino)
+{
+    return (size_t)(ino * 31 + dev) * 2654435761u;
+}
+
+/**
+ * Add a file with several links to set.
+ *
+ * Returns false if it was already there.
+ */
+static bool addinode(InodeSet *set, dev_t dev, ino_t ino, unsigned long blocks)
+{
+    if (ino == 0) {
+        /* can't tell, so count it */
+        return true;
+    }
+    if (set->count * 2 >= set->capacity) {
+        size_t capacity = set->capacity ? set->capacity * 2 : 16;
+        Inode *slots = calloc(capacity, sizeof(*slots));
+        if (!slots) {
+            /* counting it again is better than failing */
+            return true;
+        }
+        for (size_t i = 0; i < set->capacity; i++) {
+            Inode *inode = &set->slots[i];
+            if (inode->ino == 0) continue;
+            size_t j = hashinode(inode->dev, inode->ino) & (capacity - 1);
+            while (slots[j].ino != 0) {
+                j = (j + 1) & (capacity - 1);
+            }
+            slots[j] = *inode;
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->capacity = capacity;
+    }
+    size_t i = hashinode(dev, ino) & (set->capacity - 1);
+    while (set->slots[i].ino != 0) {
+        if (set->slots[i].ino == ino && set->slots[i].dev == dev) {
+            return false;
+        }
+        i = (i + 1) & (set->capacity - 1);
+    }
+    set->slots[i].dev = dev;
+    set->slots[i].ino = ino;
+    set->slots[i].blocks = blocks;
+    set->count++;
+    return true;
+}
+
+/**
+ * Add a subdirectory's totals to its parent's, without counting
+ * files that are linked from both twice.
+ */
+static void mergelevel(Level *parent, Level *child)
+{
+    parent->size.blocks += child->size.blocks;
+    parent->size.entries += child->size.entries;
+    /* add the smaller set to the larger */
+    if (child->links.count > parent->links.count) {
+        InodeSet larger = child->links;
+        child->links = parent->links;
+        parent->links = larger;
+    }
+    for (size_t i = 0; i < child->links.capacity; i++) {
+        Inode *inode = &child->links.slots[i];
+        if (inode->ino == 0) continue;
+        if (!addinode(&parent->links, inode->dev, inode->ino, inode->blocks)) {
+            parent->size.blocks -= inode->blocks;
+            parent->size.entries--;
+        }
+    }
+    free(child->links.slots);
+    child->links.slots = NULL;
+    child->links.capacity = child->links.count = 0;
+}
+
+/**
+ * Count file itself in level.
+ */
+static void addfile(Level *level, File *file, Options *options)
+{
+    unsigned long blocks = getblocks(file, options->blocksize);
+    if (!isdir(file) && getlinkcount(file) > 1 &&
+            !addinode(&level->links, getdev(file), getinode(file), blocks)) {
+        return;
+    }
+    level->size.blocks += blocks;
+    level->size.entries++;
+}
+
+/**
+ * Keep size for gettreesize() to find.
+ */
+static void keepsize(dev_t dev, ino_t ino, TreeSize size, char *errors)
+{
+    SizeEntry *entry = malloc(sizeof(*entry));
+    if (!entry) {
+        /* it'll just be worked out again */
+        free(errors);
+        return;
+    }
+    entry->dev = dev;
+    entry->ino = ino;
+    entry->size = size;
+    entry->errors = errors;
+
+    pthread_mutex_lock(&sizeslock);
+    if (nsizes >= nslots) {
+        size_t capacity = nslots ? nslots * 2 : 64;
+        SizeEntry **slots = calloc(capacity, sizeof(*slots));
+        if (slots) {
+            for (size_t i = 0; i < nslots; i++) {
+                while (sizes[i]) {
+                    SizeEntry *moved = sizes[i];
+                    sizes[i] = moved->next;
+                    size_t j = hashinode(moved->dev, moved->ino) & (capacity - 1);
+                    moved->next = slots[j];
+                    slots[j] = moved;
+                }
+            }
+            free(sizes);
+            sizes = slots;
+            nslots = capacity;
+        }
+    }
+    if (nslots == 0) {
+        pthread_mutex_unlock(&sizeslock);
+        free(entry->errors);
+        free(entry);
+        return;
+    }
+    size_t i = hashinode(dev, ino) & (nslots - 1);
+    entry->next = sizes[i];
+    sizes[i] = entry;
+    nsizes++;
+    pthread_mutex_unlock(&sizeslock);
+}
+
+/**
+ * Return true if there's a size kept for dev and ino.
+ */
+static bool hassize(dev_t dev, ino_t ino)
+{
+    bool found = false;
+    pthread_mutex_lock(&sizeslock);
+    if (nslots > 0) {
+        SizeEntry *entry = sizes[hashinode(dev, ino) & (nslots - 1)];
+        for (; entry && !found; entry = entry->next) {
+            found = entry->dev == dev && entry->ino == ino;
+        }
+    }
+    pthread_mutex_unlock(&sizeslock);
+    return found;
+}
+
+/**
+ * Remove and return the size kept for dev and ino, NULL if there isn't one.
+ */
+static SizeEntry *takesize(dev_t dev, ino_t ino)
+{
+    SizeEntry *found = NULL;
+    pthread_mutex_lock(&sizeslock);
+    if (nslots > 0) {
+        SizeEntry **pentry = &sizes[hashinode(dev, ino) & (nslots - 1)];
+        for (; *pentry; pentry = &(*pentry)->next) {
+            if ((*pentry)->dev == dev && (*pentry)->ino == ino) {
+                found = *pentry;
+                *pentry = found->next;
+                nsizes--;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&sizeslock);
+    return found;
+}
+
+/**
+ * Return true if the listing shows dir's name, which is in a directory it
+ * lists, as readentries() in l.c would.
+ */
+static bool isshown(File *dir, Options *options)
+{
+    const char *name = getname(dir);
+    if (!options->all && name[0] == '.') {
+        return false;
+    }
+    return !options->ignore || !matchpatterns(options->ignore, name);
+}
+
+/**
+ * Return true if -R goes into dir, depth directories down from an argument,
+ * given that it goes into the directory dir's in.
+ */
+static bool isgoneinto(File *dir, int depth, Options *options)
+{
+    const char *name = getname(dir);
+    if (!options->recursive ||
+            (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))) {
+        return false;
+    }
+    if (options->maxdepth >= 0 && depth > options->maxdepth) {
+        return false;
+    }
+    return isshown(dir, options);
+}
+
+/**
+ * Return true if the listing will ask for subdir's size, given that it goes
+ * into the directory subdir's in, which is depth - 1 directories down.
+ */
+static bool isasked(File *subdir, int depth, Options *options)
+{
+    if (depth - 1 < options->mindepth || !isshown(subdir, options)) {
+        return false;
+    }
+    /* --tree also shows directories it goes into that don't match */
+    return !options->where || matchfile(options->where, subdir, options->now) ||
+           (options->tree && isgoneinto(subdir, depth, options));
+}
+
+static void walkdir(File *dir, int dirfd, dev_t dev, Ancestor *up, int depth,
+                    Options *options, Level *level);
+
+/**
+ * Count subdir, an entry of a directory being walked, and everything in it.
+ *
+ * depth is how many directories down subdir is from an argument, or -1 if
+ * -R doesn't go into the directory subdir is in, so its size isn't kept.
+ */
+static void walksubdir(File *subdir, dev_t dev, Ancestor *up, int depth, Options *options,
+                       Level *level)
+{
+    Level child = { { 0, 0 }, { NULL, 0, 0 } };
+    addfile(&child, subdir, options);
+    if (options->onefilesystem && getdev(subdir) != dev) {
+        mergelevel(level, &child);
+        return;
+    }
+    int subfd = opendirectory(subdir);
+    struct stat st;
+    if (subfd == -1) {
+        errorf("Cannot open %s: %s\n", getpath(subdir), strerror(errno));
+    } else if (fstat(subfd, &st) != 0) {
+        errorf("Cannot stat %s: %s\n", getpath(subdir), strerror(errno));
+    } else {
+        Ancestor here = { st.st_dev, st.st_ino, up };
+        bool cycle = false;
+        for (Ancestor *a = up; a && !cycle; a = a->up) {
+            cycle = a->dev == here.dev && a->ino == here.ino;
+        }
+        if (cycle) {
+            errorf("%s: not counting already-counted directory\n", getpath(subdir));
+        } else {
+            bool goneinto = depth >= 0 && isgoneinto(subdir, depth, options);
+            walkdir(subdir, subfd, dev, &here, goneinto ? depth + 1 : -1, options, &child);
+            /* -R will want it when it gets there (but not the top,
+             * whose size is being worked out right now) */
+            if (up && depth >= 0 && isasked(subdir, depth, options)) {
+                keepsize(getdev(subdir), getinode(subdir), child.size, NULL);
+            }
+        }
+    }
+    if (subfd != -1) {
+        close(subfd);
+    }
+    mergelevel(level, &child);
+}
+
+/**
+ * Count everything in dir, which is open as dirfd, in level.
+ * depth is that of dir's entries, as for walksubdir().
+ *
+ * Only the subdirectories are kept while they're walked,
+ * so memory use depends on the depth of the tree, not its size.
+ */
+static void walkdir(File *dir, int dirfd, dev_t dev, Ancestor *up, int depth,
+                    Options *options, Level *level)
+{
+    DirReader *reader = newdirreader(dirfd, WALKBUFSIZE);
+    if (!reader) {
+        errorf("Cannot read %s: %s\n", getpath(dir), strerror(errno));
+        return;
+    }
+    List *subdirs = NULL;
+    const DirEntry *entry;
+    int readerror = 0;
+    while ((entry = readdirentry(reader)) != NULL || (readerror = errno) != 0) {
+        if (!entry) {
+            break;
+        }
+        const char *name = entry->name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+        File *file = newfilein(dirfd, dir, name);
+        if (!file) {
+            break;
+        }
+        setdirentinfo(file, entry->inode, entry->type);
+        if (isdir(file) && (subdirs || (subdirs = newlist()) != NULL)) {
+            append(file, subdirs);
+        } else {
+            addfile(level, file, options);
+            freefile(file);
+        }
+    }
+    if (readerror != 0) {
+        errorf("Cannot read %s: %s\n", getpath(dir), strerror(readerror));
+    }
+    freedirreader(reader);
+
+    int nsubdirs = subdirs ? length(subdirs) : 0;
+    for (int i = 0; i < nsubdirs; i++) {
+        File *subdir = getitem(subdirs, i);
+        walksubdir(subdir, dev, up, depth, options, level);
+        freefile(subdir);
+        setitem(subdirs, i, NULL);
+    }
+    freelist(subdirs, (free_func)freefile);
+}
+
+/**
+ * Work out file's tree size.
+ */
+static TreeSize walktree(File *file, Options *options)
+{
+    Level top = { { 0, 0 }, { NULL, 0, 0 } };
+    if (!isstat(file)) {
+        /* no entries means unknown */
+        return top.size;
+    }
+    if (isdir(file)) {
+        walksubdir(file, getdev(file), NULL, getdepth(file), options, &top);
+    } else {
+        addfile(&top, file, options);
+    }
+    free(top.links.slots);
+    return top.size;
+}
+
+/* error handler that adds each message to the string at context */
+static void keeperror(const char *message, void *context)
+{
+    char **perrors = context;
+    size_t oldlen = *perrors ? strlen(*perrors) : 0;
+    char *errors = realloc(*perrors, oldlen + strlen(message) + 1);
+    if (!errors) {
+        /* better out of order than lost */
+        fputs(message, stderr);
+        return;
+    }
+    strcpy(errors + oldlen, message);
+    *perrors = errors;
+}
+
+void fetchtreesize(File *file, Options *options)
+{
+    if (!file || !options) {
+        errorf("file or options is NULL\n");
+        return;
+    }
+    /* only directories take any working out */
+    if (!isstat(file) || !isdir(file)) {
+        return;
+    }
+    if (hassize(getdev(file), getinode(file))) {
+        /* already walked, as part of a directory above it */
+        return;
+    }
+
+    error_handler oldhandler;
+    void *oldcontext;
+    geterrorhandler(&oldhandler, &oldcontext);
+    char *errors = NULL;
+    seterrorhandler(keeperror, &errors);
+    TreeSize size = walktree(file, options);
+    seterrorhandler(oldhandler, oldcontext);
+    keepsize(getdev(file), getinode(file), size, errors);
+}
+
+TreeSize gettreesize(File *file, Options *options)
+{
+    TreeSize size = { 0, 0 };
+    if (!file || !options) {
+        errorf("file or options is NULL\n");
+        return size;
+    }
+    if (isstat(file) && isdir(file)) {
+        SizeEntry *kept = takesize(getdev(file), getinode(file));
+        if (kept) {
+            if (kept->errors) {
+                reporterror(kept->errors);
+            }
+            size = kept->size;
+            free(kept->errors);
+            free(kept);
+            return size;
+        }
+    }
+    return walktree(file, options);
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,36 @@
+#ifndef TREESIZE_H
+#define TREESIZE_H
+
+#include "file.h"
+#include "options.h"
+
+/* the size of a file and, if it's a directory, everything under it */
+typedef struct treesize {
+    unsigned long blocks;           /* in options->blocksize units, summed from getblocks() */
+    unsigned long entries;          /* the file itself and everything under it, 0 = unknown */
+} TreeSize;
+
+/**
+ * Work out file's tree size now, so gettreesize() only has to look it up.
+ *
+ * Like du -s, a file with several hard links in the tree is counted once.
+ * With --one-file-system, directories on other file systems are counted
+ * but not gone into.
+ *
+ * Errors are kept and reported by gettreesize(), so they come out in the
+ * same place either way.  Different files can be fetched at the same time
+ * on different threads.
+ */
+void fetchtreesize(File *file, Options *options);
+
+/**
+ * Return file's tree size, walking the tree under it
+ * if fetchtreesize() hasn't already done that.
+ *
+ * With -R, the sizes of the directories under file are kept from the walk
+ * until they're listed, so each directory is only walked once.
+ */
+TreeSize gettreesize(File *file, Options *options);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,213 @@
+#define _GNU_SOURCE             /* for syscall() on glibc */
+
+#include <sys/types.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logging.h"
+
+/* how many requests to ask for room for, the kernel may round it up */
+#define RINGSIZE 256
+
+/*
+ * There's no liburing dependency, so this talks to the kernel directly.
+ * See io_uring_setup(2) and io_uring_enter(2).
+ *
+ * The ring is set up the first time it's needed and kept until exit.
+ */
+static struct ring {
+    int fd;
+    unsigned int entries;       /* room in the submission queue */
+    unsigned int *sqhead, *sqtail, *sqmask, *sqarray;
+    struct io_uring_sqe *sqes;
+    unsigned int *cqhead, *cqtail, *cqmask;
+    struct io_uring_cqe *cqes;
+} ring = { .fd = -1 };
+
+/* set if io_uring can't be used, so we don't keep trying */
+static bool unavailable = false;
+
+/* the ring is used by one thread at a time */
+static pthread_mutex_t ringlock = PTHREAD_MUTEX_INITIALIZER;
+
+static int setupring(void)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, RINGSIZE, &params);
+    if (fd < 0) {
+        /* old kernel, or disabled, e.g. by seccomp */
+        return -1;
+    }
+
+    size_t sqsize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    size_t cqsize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singlemmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singlemmap) {
+        sqsize = cqsize = sqsize > cqsize ? sqsize : cqsize;
+    }
+    char *sq = mmap(NULL, sqsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    char *cq = sq;
+    if (!singlemmap) {
+        cq = mmap(NULL, cqsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            munmap(sq, sqsize);
+            close(fd);
+            return -1;
+        }
+    }
+    size_t sqessize = params.sq_entries * sizeof(struct io_uring_sqe);
+    struct io_uring_sqe *sqes = mmap(NULL, sqessize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (!singlemmap) munmap(cq, cqsize);
+        munmap(sq, sqsize);
+        close(fd);
+        return -1;
+    }
+
+    ring.fd = fd;
+    ring.entries = params.sq_entries;
+    ring.sqhead = (unsigned int *)(sq + params.sq_off.head);
+    ring.sqtail = (unsigned int *)(sq + params.sq_off.tail);
+    ring.sqmask = (unsigned int *)(sq + params.sq_off.ring_mask);
+    ring.sqarray = (unsigned int *)(sq + params.sq_off.array);
+    ring.sqes = sqes;
+    ring.cqhead = (unsigned int *)(cq + params.cq_off.head);
+    ring.cqtail = (unsigned int *)(cq + params.cq_off.tail);
+    ring.cqmask = (unsigned int *)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/**
+ * Queue calls[index] in the next free submission queue entry.
+ */
+static void queuestatx(StatxCall *calls, size_t index)
+{
+    /* we're the only producer, so our own tail needs no barrier to read */
+    unsigned int tail = *ring.sqtail;
+    unsigned int slot = tail & *ring.sqmask;
+    struct io_uring_sqe *sqe = &ring.sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = calls[index].dirfd;
+    sqe->addr = (uintptr_t)calls[index].path;
+    sqe->len = calls[index].mask;
+    sqe->off = (uintptr_t)calls[index].buf;
+    sqe->statx_flags = calls[index].flags;
+    sqe->user_data = index;
+    ring.sqarray[slot] = slot;
+
+    /* the kernel mustn't see the new tail before the entry it covers */
+    __atomic_store_n(ring.sqtail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Collect any completed calls.
+ *
+ * Returns the number collected.
+ */
+static size_t reapstatx(StatxCall *calls)
+{
+    size_t nreaped = 0;
+    unsigned int head = *ring.cqhead;
+    unsigned int tail = __atomic_load_n(ring.cqtail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cqmask];
+        StatxCall *call = &calls[cqe->user_data];
+        call->error = cqe->res < 0 ? -cqe->res : 0;
+        call->done = true;
+        head++;
+        nreaped++;
+    }
+    __atomic_store_n(ring.cqhead, head, __ATOMIC_RELEASE);
+    return nreaped;
+}
+
+/**
+ * Do the work of uringstatx(), with ringlock held.
+ */
+static int dostatx(StatxCall *calls, size_t ncalls)
+{
+    if (unavailable) {
+        return -1;
+    }
+    if (ring.fd == -1 && setupring() != 0) {
+        unavailable = true;
+        return -1;
+    }
+
+    size_t nqueued = 0;         /* calls put in the submission queue */
+    size_t nunsubmitted = 0;    /* queued calls the kernel hasn't taken yet */
+    size_t ninflight = 0;       /* calls the kernel has taken that haven't completed */
+    bool failed = false;
+    while (ninflight > 0 || (!failed && nqueued < ncalls)) {
+        while (!failed && nqueued < ncalls && ninflight + nunsubmitted < ring.entries) {
+            queuestatx(calls, nqueued);
+            nqueued++;
+            nunsubmitted++;
+        }
+        int nsubmitted = syscall(__NR_io_uring_enter, ring.fd, nunsubmitted, 1,
+                                 IORING_ENTER_GETEVENTS, NULL, 0);
+        if (nsubmitted < 0) {
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY && !failed) {
+                /* take back what the kernel hasn't seen, and give up once
+                 * it's finished with the buffers it already has */
+                errorf("io_uring_enter: %s\n", strerror(errno));
+                *ring.sqtail -= nunsubmitted;
+                nunsubmitted = 0;
+                failed = true;
+                unavailable = true;
+            }
+            ninflight -= reapstatx(calls);
+            continue;
+        }
+        nunsubmitted -= nsubmitted;
+        ninflight += nsubmitted;
+        ninflight -= reapstatx(calls);
+    }
+    return failed ? -1 : 0;
+}
+
+int uringstatx(StatxCall *calls, size_t ncalls)
+{
+    if (pthread_mutex_trylock(&ringlock) != 0) {
+        /* in use on another thread, which is already keeping the disk busy */
+        errno = EBUSY;
+        return -1;
+    }
+    int status = dostatx(calls, ncalls);
+    pthread_mutex_unlock(&ringlock);
+    return status;
+}
+
+#else
+
+int uringstatx(StatxCall *calls, size_t ncalls)
+{
+    (void)calls;
+    (void)ncalls;
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
@@ -0,0 +1,38 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct statx;
+
+/**
+ * A statx() to be done as part of a batch.
+ *
+ * The caller fills in everything up to buf.
+ * path and buf must stay valid until uringstatx() returns.
+ */
+typedef struct statxcall {
+    int dirfd;
+    const char *path;
+    int flags;
+    unsigned int mask;
+    struct statx *buf;
+    bool done;                  /* set when the call has completed */
+    int error;                  /* 0 on success, else an errno value */
+} StatxCall;
+
+/**
+ * Do all of calls using io_uring, keeping many of them in flight at once,
+ * so that slow storage sees a deep queue rather than one request at a time.
+ *
+ * Only available on Linux when built with -DHAVE_IO_URING.
+ *
+ * Returns 0 when all the calls are done, or -1 if io_uring can't be used,
+ * or is in use on another thread, in which case the caller should do any
+ * calls that aren't done itself.
+ */
+int uringstatx(StatxCall *calls, size_t ncalls);
+
+#endif
+/* vim: set ts=4 sw=4 tw=0 et:*/
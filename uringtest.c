@@ -0,0 +1,67 @@
+#define _GNU_SOURCE         /* for struct statx on glibc */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/stat.h>
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "logging.h"
+#include "uring.h"
+
+void test_batch_statx();
+
+int main(int argc, char **argv)
+{
+    myname = "uringtest";
+
+    test_batch_statx();
+    return 0;
+}
+
+void test_batch_statx()
+{
+#ifdef HAVE_IO_URING
+    /* more than fit in the ring at once */
+    enum { NCALLS = 1000 };
+    static StatxCall calls[NCALLS];
+    static struct statx bufs[NCALLS];
+    for (int i = 0; i < NCALLS; i++) {
+        calls[i].dirfd = AT_FDCWD;
+        /* every third one doesn't exist */
+        calls[i].path = i % 3 == 2 ? "/nonexistent/uringtest" : "/";
+        calls[i].flags = AT_SYMLINK_NOFOLLOW;
+        calls[i].mask = STATX_TYPE | STATX_INO;
+        calls[i].buf = &bufs[i];
+        calls[i].done = false;
+        calls[i].error = -1;
+    }
+    if (uringstatx(calls, NCALLS) != 0) {
+        /* e.g. disabled in a container, this is allowed */
+        errorf("io_uring not available, skipping\n");
+        return;
+    }
+    struct stat root;
+    assert(stat("/", &root) == 0);
+    for (int i = 0; i < NCALLS; i++) {
+        assert(calls[i].done);
+        if (i % 3 == 2) {
+            assert(calls[i].error == ENOENT);
+        } else {
+            assert(calls[i].error == 0);
+            assert(S_ISDIR(bufs[i].stx_mode));
+            assert(bufs[i].stx_ino == root.st_ino);
+        }
+    }
+#else
+    StatxCall call;
+    assert(uringstatx(&call, 1) == -1);
+#endif
+}
+
+/* vim: set ts=4 sw=4 tw=0 et:*/